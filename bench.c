@@ -0,0 +1,495 @@
+#include "djbhash.h"
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+// Key distributions.
+enum bench_distribution {
+  // "key000...0001", "key000...0002", ...
+  BENCH_SEQUENTIAL,
+  // Random alphanumeric keys.
+  BENCH_RANDOM,
+  // Random keys, looked up with Zipfian skew (a few keys get most lookups).
+  BENCH_ZIPF,
+  // Concatenations of "Ez" / "FY", which all share one DJB2 hash.
+  BENCH_COLLIDE,
+};
+
+static const char *bench_distribution_names[] = { "sequential", "random", "zipf", "collide" };
+static const char *bench_function_names[] = { "djb2", "wy" };
+
+// Largest table built from colliding keys while hashing with DJB2 (every probe is a full scan).
+#define BENCH_COLLIDE_MAX 20000
+// Largest table serialized to JSON and used for the thread scaling runs.
+#define BENCH_JSON_MAX 1000000
+// Lookups and updates each thread does in a scaling run.
+#define BENCH_THREAD_OPS 2000000
+
+// Settings for a run.
+struct bench_config {
+  size_t sizes[16];
+  int size_count;
+  int key_length;
+  double miss_ratio;
+  int threads[16];
+  int thread_count;
+  int distributions[4];
+  int distribution_count;
+  FILE *csv;
+};
+
+// Keys for a run: fixed width, packed into one buffer.
+struct bench_keys {
+  char *data;
+  size_t stride;
+  size_t count;
+};
+
+// Work for one thread of a scaling run.
+struct bench_thread {
+  struct djbhash_concurrent *hash;
+  struct bench_keys *keys;
+  uint64_t seed;
+  long ops;
+};
+
+// Small fast PRNG (xorshift64*).
+static inline uint64_t bench_random( uint64_t *state )
+{
+  *state ^= *state >> 12;
+  *state ^= *state << 25;
+  *state ^= *state >> 27;
+  return *state * 2685821657736338717ULL;
+}
+
+// Monotonic time in nanoseconds.
+static inline double bench_now( void )
+{
+  struct timespec ts;
+
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Resident set size, in bytes.
+static size_t bench_rss( void )
+{
+  FILE *file;
+  long pages, resident;
+
+  resident = 0;
+  if ( ( file = fopen( "/proc/self/statm", "r" ) ) != NULL )
+  {
+    if ( fscanf( file, "%ld %ld", &pages, &resident ) != 2 )
+      resident = 0;
+    fclose( file );
+  }
+  return ( size_t )resident * sysconf( _SC_PAGESIZE );
+}
+
+// Peak resident set size of this process so far, in KB. Each run has a process of its own (see
+//   bench_run_isolated), so this is the peak of the current run alone.
+static long bench_peak_rss( void )
+{
+  struct rusage usage;
+
+  getrusage( RUSAGE_SELF, &usage );
+  return usage.ru_maxrss;
+}
+
+// Key `i` of a key set.
+static inline char *bench_key( struct bench_keys *keys, size_t i )
+{
+  return keys->data + i * keys->stride;
+}
+
+// Generate `count` keys; `miss` keys are disjoint from the non-miss keys of the same distribution.
+static void bench_make_keys( struct bench_keys *keys, int distribution, size_t count, int length, int miss )
+{
+  static const char alphabet[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+  uint64_t state;
+  size_t i, index;
+  int j, blocks;
+  char *key;
+
+  // Colliding keys need one two byte block per bit of the index.
+  blocks = 1;
+  while ( ( ( size_t )1 << blocks ) < count * 2 )
+    blocks++;
+  if ( distribution == BENCH_COLLIDE )
+    length = blocks * 2;
+
+  keys->stride = length + 1;
+  keys->count = count;
+  keys->data = malloc( keys->stride * count );
+  state = miss ? 0x9E3779B97F4A7C15ULL : 0xD1B54A32D192ED03ULL;
+  for ( i = 0; i < count; i++ )
+  {
+    key = bench_key( keys, i );
+    switch ( distribution )
+    {
+      case BENCH_SEQUENTIAL:
+        snprintf( key, keys->stride, "%c%0*zu", miss ? '#' : 'k', length - 1, i );
+        break;
+      case BENCH_COLLIDE:
+        // Misses use the upper half of the index space, so they collide too.
+        index = miss ? i + count : i;
+        for ( j = 0; j < blocks; j++ )
+          memcpy( key + j * 2, ( index >> j ) & 1 ? "FY" : "Ez", 2 );
+        break;
+      default:
+        for ( j = 0; j < length; j++ )
+          key[j] = alphabet[bench_random( &state ) % ( sizeof( alphabet ) - 1 )];
+        if ( miss )
+          key[0] = '#';
+    }
+    key[length] = '\0';
+  }
+}
+
+// Index of the next key to look up.
+static inline size_t bench_pick( int distribution, size_t count, uint64_t *state )
+{
+  double u;
+  size_t rank;
+
+  if ( distribution != BENCH_ZIPF )
+    return bench_random( state ) % count;
+
+  // Zipf with s = 1: P(rank <= k) ~ ln(k + 1) / ln(n + 1). Scatter ranks over the key set.
+  u = ( bench_random( state ) >> 11 ) * ( 1.0 / 9007199254740992.0 );
+  rank = ( size_t )exp( u * log( ( double )count + 1 ) ) - 1;
+  if ( rank >= count )
+    rank = count - 1;
+  return ( rank * 2654435761ULL ) % count;
+}
+
+// Report one measurement on stdout and in the CSV file.
+static void bench_report( struct bench_config *config, int function, int distribution, size_t size, int threads, const char *operation, size_t ops, double ns, double bytes_per_entry )
+{
+  double ns_per_op, mops;
+
+  ns_per_op = ops ? ns / ops : 0;
+  mops = ns > 0 ? ops * 1e3 / ns : 0;
+  printf( "%-5s %-10s %10zu %3d  %-10s %10.1f ns/op %9.2f Mops/s", bench_function_names[function], bench_distribution_names[distribution], size, threads, operation, ns_per_op, mops );
+  if ( bytes_per_entry > 0 )
+    printf( " %7.1f B/entry", bytes_per_entry );
+  printf( "\n" );
+  if ( config->csv != NULL )
+  {
+    fprintf( config->csv, "%s,%s,%zu,%d,%.3f,%d,%s,%zu,%.2f,%.3f,%.1f,%ld\n", bench_function_names[function], bench_distribution_names[distribution], size, config->key_length, config->miss_ratio, threads, operation, ops, ns_per_op, mops, bytes_per_entry, bench_peak_rss() );
+    fflush( config->csv );
+  }
+}
+
+// Scaling run worker: mostly lookups, some updates.
+static void *bench_thread_main( void *arg )
+{
+  struct bench_thread *work;
+  size_t i;
+  long op;
+  int value;
+
+  work = arg;
+  value = 1;
+  for ( op = 0; op < work->ops; op++ )
+  {
+    i = bench_random( &work->seed ) % work->keys->count;
+    if ( op % 10 == 0 )
+      djbhash_concurrent_set( work->hash, bench_key( work->keys, i ), &value, DJBHASH_INT );
+    else
+      djbhash_concurrent_find( work->hash, bench_key( work->keys, i ), NULL, NULL );
+  }
+  return NULL;
+}
+
+// Throughput of a shared hash as threads are added.
+static void bench_threads( struct bench_config *config, int function, int distribution, struct bench_keys *keys )
+{
+  struct djbhash_concurrent hash;
+  struct bench_thread work[64];
+  pthread_t threads[64];
+  size_t i;
+  int t, n, value;
+  double start;
+
+  djbhash_concurrent_init( &hash, 64 );
+  djbhash_concurrent_set_hash_function( &hash, function, 0x5EED );
+  value = 0;
+  for ( i = 0; i < keys->count; i++ )
+    djbhash_concurrent_set( &hash, bench_key( keys, i ), &value, DJBHASH_INT );
+
+  for ( t = 0; t < config->thread_count; t++ )
+  {
+    n = config->threads[t] < 64 ? config->threads[t] : 64;
+    start = bench_now();
+    for ( i = 0; i < ( size_t )n; i++ )
+    {
+      work[i].hash = &hash;
+      work[i].keys = keys;
+      work[i].seed = 0x1234567ULL * ( i + 1 );
+      work[i].ops = BENCH_THREAD_OPS;
+      pthread_create( &threads[i], NULL, bench_thread_main, &work[i] );
+    }
+    for ( i = 0; i < ( size_t )n; i++ )
+      pthread_join( threads[i], NULL );
+    bench_report( config, function, distribution, keys->count, n, "mixed_90r", ( size_t )n * BENCH_THREAD_OPS, bench_now() - start, 0 );
+  }
+  djbhash_concurrent_destroy( &hash );
+}
+
+// All single threaded measurements for one size, distribution and hash function.
+static void bench_run( struct bench_config *config, int function, int distribution, size_t size )
+{
+  struct djbhash hash;
+  struct bench_keys keys, misses;
+  struct djbhash_node *item, *results[1024];
+  struct djbhash_cursor cursor;
+  char *batch[1024];
+  size_t i, j, lookups, found, rss;
+  uint64_t state;
+  double start, bytes;
+  unsigned char *json;
+  int value;
+
+  if ( distribution == BENCH_COLLIDE && function == DJBHASH_FUNCTION_DJB2 && size > BENCH_COLLIDE_MAX )
+    size = BENCH_COLLIDE_MAX;
+  bench_make_keys( &keys, distribution, size, config->key_length, false );
+  bench_make_keys( &misses, distribution, size, config->key_length, true );
+
+  // Inserts, and the memory they took.
+  rss = bench_rss();
+  djbhash_init( &hash );
+  djbhash_set_hash_function( &hash, function, 0x5EED );
+  value = 1;
+  start = bench_now();
+  for ( i = 0; i < size; i++ )
+    djbhash_set( &hash, bench_key( &keys, i ), &value, DJBHASH_INT );
+  bytes = ( double )( bench_rss() - rss ) / size;
+  bench_report( config, function, distribution, size, 1, "set", size, bench_now() - start, bytes > 0 ? bytes : 0 );
+
+  // Updates of existing keys.
+  start = bench_now();
+  for ( i = 0; i < size; i++ )
+    djbhash_set( &hash, bench_key( &keys, i ), &value, DJBHASH_INT );
+  bench_report( config, function, distribution, size, 1, "update", size, bench_now() - start, 0 );
+
+  // Lookups with the configured miss ratio.
+  lookups = size < 1000000 ? 1000000 : size;
+  if ( distribution == BENCH_COLLIDE && function == DJBHASH_FUNCTION_DJB2 )
+    lookups = size;
+  state = 42;
+  found = 0;
+  start = bench_now();
+  for ( i = 0; i < lookups; i++ )
+  {
+    j = bench_pick( distribution, size, &state );
+    if ( ( bench_random( &state ) >> 11 ) * ( 1.0 / 9007199254740992.0 ) < config->miss_ratio )
+      found += djbhash_find( &hash, bench_key( &misses, j ) ) != NULL;
+    else
+      found += djbhash_find( &hash, bench_key( &keys, j ) ) != NULL;
+  }
+  bench_report( config, function, distribution, size, 1, "find", lookups, bench_now() - start, 0 );
+
+  // The same lookups, batched.
+  state = 42;
+  start = bench_now();
+  for ( i = 0; i < lookups; i += j )
+  {
+    for ( j = 0; j < 1024 && i + j < lookups; j++ )
+    {
+      batch[j] = bench_key( &keys, bench_pick( distribution, size, &state ) );
+      if ( ( bench_random( &state ) >> 11 ) * ( 1.0 / 9007199254740992.0 ) < config->miss_ratio )
+        batch[j] = bench_key( &misses, bench_pick( distribution, size, &state ) );
+    }
+    djbhash_find_many( &hash, batch, NULL, j, results );
+  }
+  bench_report( config, function, distribution, size, 1, "find_many", lookups, bench_now() - start, 0 );
+
+  // Full traversals.
+  start = bench_now();
+  djbhash_reset_iterator( &hash );
+  for ( i = 0; ( item = djbhash_iterate( &hash ) ) != NULL; i++ )
+    ;
+  bench_report( config, function, distribution, size, 1, "iterate", i, bench_now() - start, 0 );
+  start = bench_now();
+  djbhash_cursor_init( &hash, &cursor );
+  for ( i = 0; ( item = djbhash_cursor_next( &hash, &cursor ) ) != NULL; i++ )
+    ;
+  bench_report( config, function, distribution, size, 1, "cursor", i, bench_now() - start, 0 );
+
+  if ( size <= BENCH_JSON_MAX )
+  {
+    start = bench_now();
+    json = djbhash_to_json( &hash );
+    bench_report( config, function, distribution, size, 1, "to_json", size, bench_now() - start, 0 );
+    free( json );
+  }
+
+  // Removes of every key.
+  start = bench_now();
+  for ( i = 0; i < size; i++ )
+    djbhash_remove( &hash, bench_key( &keys, i ) );
+  bench_report( config, function, distribution, size, 1, "remove", size, bench_now() - start, 0 );
+  djbhash_destroy( &hash );
+
+  if ( config->thread_count > 0 && distribution != BENCH_COLLIDE && size <= BENCH_JSON_MAX )
+    bench_threads( config, function, distribution, &keys );
+
+  free( keys.data );
+  free( misses.data );
+}
+
+// Do a run in a child process, so its peak RSS isn't the high-water mark of earlier, larger runs.
+//   Runs in this process if it can't fork.
+static void bench_run_isolated( struct bench_config *config, int function, int distribution, size_t size )
+{
+  pid_t pid;
+  int status;
+
+  fflush( stdout );
+  fflush( config->csv );
+  pid = fork();
+  if ( pid < 0 )
+  {
+    bench_run( config, function, distribution, size );
+    return;
+  }
+  if ( pid == 0 )
+  {
+    bench_run( config, function, distribution, size );
+    fflush( stdout );
+    fflush( config->csv );
+    _exit( 0 );
+  }
+  while ( waitpid( pid, &status, 0 ) < 0 )
+    ;
+  if ( !WIFEXITED( status ) || WEXITSTATUS( status ) != 0 )
+    fprintf( stderr, "%s %s %zu: run failed\n", bench_function_names[function], bench_distribution_names[distribution], size );
+}
+
+// Parse a comma separated list of numbers ("1k", "10M" allowed).
+static int bench_parse_list( const char *arg, size_t *out, int max )
+{
+  char *end;
+  int count;
+  double value;
+
+  count = 0;
+  while ( *arg && count < max )
+  {
+    value = strtod( arg, &end );
+    if ( end == arg )
+      break;
+    if ( *end == 'k' || *end == 'K' )
+      value *= 1e3, end++;
+    else if ( *end == 'm' || *end == 'M' )
+      value *= 1e6, end++;
+    out[count++] = ( size_t )value;
+    arg = *end == ',' ? end + 1 : end;
+  }
+  return count;
+}
+
+static void bench_usage( const char *name )
+{
+  printf( "Usage: %s [-n sizes] [-k key length] [-d distributions] [-m miss ratio] [-t threads] [-o csv file]\n", name );
+  printf( "  -n  table sizes, e.g. 1k,100k,1M,100M (default 1k,100k,1M)\n" );
+  printf( "  -k  key length for sequential / random keys (default 16)\n" );
+  printf( "  -d  sequential,random,zipf,collide (default all)\n" );
+  printf( "  -m  fraction of lookups for missing keys (default 0.1)\n" );
+  printf( "  -t  thread counts for the scaling runs, 0 to skip (default 1,2,4,8)\n" );
+  printf( "  -o  CSV results file (default bench.csv)\n" );
+}
+
+int main( int argc, char *argv[] )
+{
+  struct bench_config config;
+  struct rusage usage;
+  size_t list[16];
+  const char *csv_path;
+  char *names, *name;
+  int opt, i, d, f;
+
+  config.size_count = bench_parse_list( "1k,100k,1M", config.sizes, 16 );
+  config.key_length = 16;
+  config.miss_ratio = 0.1;
+  config.thread_count = 4;
+  for ( i = 0; i < 4; i++ )
+  {
+    config.threads[i] = 1 << i;
+    config.distributions[i] = i;
+  }
+  config.distribution_count = 4;
+  csv_path = "bench.csv";
+
+  while ( ( opt = getopt( argc, argv, "n:k:d:m:t:o:h" ) ) != -1 )
+  {
+    switch ( opt )
+    {
+      case 'n':
+        config.size_count = bench_parse_list( optarg, config.sizes, 16 );
+        break;
+      case 'k':
+        config.key_length = atoi( optarg ) > 1 ? atoi( optarg ) : 2;
+        break;
+      case 'd':
+        config.distribution_count = 0;
+        names = strdup( optarg );
+        for ( name = strtok( names, "," ); name != NULL && config.distribution_count < 4; name = strtok( NULL, "," ) )
+        {
+          for ( d = 0; d < 4; d++ )
+          {
+            if ( strcmp( name, bench_distribution_names[d] ) == 0 )
+              config.distributions[config.distribution_count++] = d;
+          }
+        }
+        free( names );
+        break;
+      case 'm':
+        config.miss_ratio = atof( optarg );
+        break;
+      case 't':
+        config.thread_count = bench_parse_list( optarg, list, 16 );
+        for ( i = 0; i < config.thread_count; i++ )
+          config.threads[i] = ( int )list[i];
+        if ( config.thread_count == 1 && list[0] == 0 )
+          config.thread_count = 0;
+        break;
+      case 'o':
+        csv_path = optarg;
+        break;
+      default:
+        bench_usage( argv[0] );
+        return opt == 'h' ? 0 : 1;
+    }
+  }
+
+  if ( ( config.csv = fopen( csv_path, "w" ) ) == NULL )
+  {
+    perror( csv_path );
+    return 1;
+  }
+  fprintf( config.csv, "function,distribution,size,key_length,miss_ratio,threads,operation,ops,ns_per_op,mops,bytes_per_entry,peak_rss_kb\n" );
+
+  // Colliding keys are run with both hash functions; the seeded one should shrug them off.
+  for ( i = 0; i < config.size_count; i++ )
+  {
+    for ( d = 0; d < config.distribution_count; d++ )
+    {
+      for ( f = DJBHASH_FUNCTION_DJB2; f <= DJBHASH_FUNCTION_WY; f++ )
+      {
+        if ( f == DJBHASH_FUNCTION_WY && config.distributions[d] != BENCH_COLLIDE )
+          continue;
+        bench_run_isolated( &config, f, config.distributions[d], config.sizes[i] );
+      }
+    }
+  }
+
+  getrusage( RUSAGE_CHILDREN, &usage );
+  printf( "Peak RSS of the largest run: %ld KB\nResults written to %s\n", usage.ru_maxrss, csv_path );
+  fclose( config.csv );
+  return 0;
+}
@@ -1,589 +1,3952 @@
 #include "djbhash.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __SSE2__
+  #include <emmintrin.h>
+#endif
+
+// Lookup counters, compiled in with -DDJBHASH_STATS.
+#ifdef DJBHASH_STATS
+  #define DJBHASH_COUNT( counter ) __atomic_fetch_add( &( counter ), 1, __ATOMIC_RELAXED )
+#else
+  #define DJBHASH_COUNT( counter ) ( ( void )0 )
+#endif
+
+#ifdef __GNUC__
+  #define DJBHASH_PREFETCH( addr ) __builtin_prefetch( addr )
+#else
+  #define DJBHASH_PREFETCH( addr ) ( ( void )( addr ) )
+#endif
+
+// Length number key lookups pass along with a pointer to the key's 8 bytes, so they never match text keys.
+#define DJBHASH_U64_LENGTH ( ( size_t )-1 )
+
+// Internal functions used ahead of their definitions.
+static void djbhash_free_value( struct djbhash_node *item );
+static void djbhash_cache_evict( struct djbhash *hash, struct djbhash_node *keep );
+static struct djbhash_search djbhash_emplace( struct djbhash *hash, const void *key, size_t length, uint64_t hash_value );
+static int djbhash_map_attach( struct djbhash *hash, const unsigned char *base, size_t size, uint64_t table, int owns_mapping );
+static struct djbhash_node *djbhash_map_node( struct djbhash *hash, unsigned int index );
+static unsigned int djbhash_map_entry( struct djbhash *hash, const void *key, size_t length, uint64_t hash_value );
+static struct djbhash_node *djbhash_map_find( struct djbhash *hash, const void *key, size_t length, uint64_t hash_value );
+static void djbhash_map_close( struct djbhash *hash );
+
+// Number of items a table with the given capacity holds before it must grow.
+static unsigned int djbhash_max_load( unsigned int capacity )
+{
+  return capacity - capacity / 8;
+}
+
+// Smallest table capacity that holds `count` items without growing.
+static unsigned int djbhash_capacity_for( unsigned int count )
+{
+  unsigned int capacity;
+
+  capacity = DJBHASH_MIN_CAPACITY;
+  while ( djbhash_max_load( capacity ) < count )
+    capacity *= 2;
+  return capacity;
+}
+
+// Allocate an empty slot table with the given capacity.
+static void djbhash_table_alloc( struct djbhash_table *table, unsigned int capacity )
+{
+  table->ctrl = malloc( sizeof( unsigned char ) * ( capacity + DJBHASH_GROUP_WIDTH ) );
+  memset( table->ctrl, DJBHASH_CTRL_EMPTY, capacity + DJBHASH_GROUP_WIDTH );
+  table->slots = malloc( sizeof( unsigned int ) * capacity );
+  table->capacity = capacity;
+  table->growth_left = djbhash_max_load( capacity );
+  table->count = 0;
+}
+
+// Reset a slot table to the unallocated state.
+static void djbhash_table_zero( struct djbhash_table *table )
+{
+  table->ctrl = NULL;
+  table->slots = NULL;
+  table->capacity = 0;
+  table->growth_left = 0;
+  table->count = 0;
+}
+
+// Free the arrays of a slot table (but not the nodes in it).
+static void djbhash_table_free( struct djbhash_table *table )
+{
+  free( table->ctrl );
+  free( table->slots );
+  djbhash_table_zero( table );
+}
+
+// Initialize the hash table.
+void djbhash_init( struct djbhash *hash )
+{
+  djbhash_init_capacity( hash, 0 );
+}
+
+// Initialize the hash table with room for `capacity` items before it first grows.
+void djbhash_init_capacity( struct djbhash *hash, unsigned int capacity )
+{
+  // Small hashes skip the slot table entirely until they outgrow the inline array.
+  djbhash_table_zero( &hash->table );
+  djbhash_table_zero( &hash->old );
+  hash->entries = NULL;
+  hash->entries_used = 0;
+  hash->entries_capacity = DJBHASH_SMALL_MAX;
+  if ( capacity > DJBHASH_SMALL_MAX )
+  {
+    djbhash_table_alloc( &hash->table, djbhash_capacity_for( capacity ) );
+    hash->entries = malloc( sizeof( struct djbhash_entry ) * capacity );
+    hash->entries_capacity = capacity;
+  }
+  hash->migrate_pos = 0;
+  hash->map = NULL;
+  hash->intern = NULL;
+  hash->cache = NULL;
+  djbhash_stats_reset( hash );
+  hash->arena = NULL;
+  hash->owns_arena = false;
+  hash->hash_function = DJBHASH_DEFAULT_FUNCTION;
+  hash->seed = DJBHASH_DEFAULT_SEED;
+  hash->count = 0;
+  djbhash_reset_iterator( hash );
+}
+
+// DJB Hash function.
+unsigned int djb_hash( char *key, int length )
+{
+  unsigned int i;
+  unsigned int hash;
+
+  hash = 5381;
+  for ( i = 0; i < length; key++, i++ )
+    hash = ( ( hash << 5 ) + hash ) + ( *key );
+  return hash;
+}
+
+// Pick the function used to hash this table's keys (only while it's empty).
+//   The seed is ignored by DJBHASH_FUNCTION_DJB2, which stays the classic unseeded DJB hash.
+int djbhash_set_hash_function( struct djbhash *hash, int function, uint64_t seed )
+{
+  if ( hash->count > 0 || hash->map != NULL || hash->intern != NULL )
+    return false;
+  if ( function != DJBHASH_FUNCTION_DJB2 && function != DJBHASH_FUNCTION_WY )
+    return false;
+  hash->hash_function = function;
+  hash->seed = seed;
+  return true;
+}
+
+// Hash a key with the table's hash function.
+uint64_t djbhash_hash_key( struct djbhash *hash, const void *key, size_t length )
+{
+  if ( hash->hash_function == DJBHASH_FUNCTION_WY )
+    return djbhash_wy_hash( key, length, hash->seed );
+  return djb_hash( ( char * )key, length );
+}
+
+// 64x64 -> 128 bit multiply, returning the low half in *a and the high half in *b.
+static inline void djbhash_mum( uint64_t *a, uint64_t *b )
+{
+#ifdef __SIZEOF_INT128__
+  __uint128_t r;
+  r = *a;
+  r *= *b;
+  *a = ( uint64_t )r;
+  *b = ( uint64_t )( r >> 64 );
+#else
+  uint64_t ha, hb, la, lb, rh, rm0, rm1, rl, t, c, lo;
+  ha = *a >> 32;
+  hb = *b >> 32;
+  la = ( uint32_t )*a;
+  lb = ( uint32_t )*b;
+  rh = ha * hb;
+  rm0 = ha * lb;
+  rm1 = hb * la;
+  rl = la * lb;
+  t = rl + ( rm0 << 32 );
+  c = t < rl;
+  lo = t + ( rm1 << 32 );
+  c += lo < t;
+  *a = lo;
+  *b = rh + ( rm0 >> 32 ) + ( rm1 >> 32 ) + c;
+#endif
+}
+
+// Multiply and fold the two halves together.
+static inline uint64_t djbhash_wy_mix( uint64_t a, uint64_t b )
+{
+  djbhash_mum( &a, &b );
+  return a ^ b;
+}
+
+// Unaligned little pieces of the key.
+static inline uint64_t djbhash_read8( const unsigned char *p )
+{
+  uint64_t v;
+  memcpy( &v, p, 8 );
+  return v;
+}
+
+static inline uint64_t djbhash_read4( const unsigned char *p )
+{
+  uint32_t v;
+  memcpy( &v, p, 4 );
+  return v;
+}
+
+// Seeded wyhash-style hash: 16 to 48 bytes per step using 64x64 -> 128 bit multiplies.
+uint64_t djbhash_wy_hash( const void *key, size_t length, uint64_t seed )
+{
+  static const uint64_t secret[4] = { 0xa0761d6478bd642fULL, 0xe7037ed1a0b428dbULL, 0x8ebc6af09c88c6e3ULL, 0x589965cc75374cc3ULL };
+  const unsigned char *p;
+  uint64_t a, b, see1, see2;
+  size_t i;
+
+  p = key;
+  seed ^= djbhash_wy_mix( seed ^ secret[0], secret[1] );
+  if ( length <= 16 )
+  {
+    if ( length >= 4 )
+    {
+      a = ( djbhash_read4( p ) << 32 ) | djbhash_read4( p + ( ( length >> 3 ) << 2 ) );
+      b = ( djbhash_read4( p + length - 4 ) << 32 ) | djbhash_read4( p + length - 4 - ( ( length >> 3 ) << 2 ) );
+    } else if ( length > 0 )
+    {
+      a = ( ( uint64_t )p[0] << 16 ) | ( ( uint64_t )p[length >> 1] << 8 ) | p[length - 1];
+      b = 0;
+    } else
+    {
+      a = b = 0;
+    }
+  } else
+  {
+    i = length;
+    if ( i > 48 )
+    {
+      see1 = seed;
+      see2 = seed;
+      do
+      {
+        seed = djbhash_wy_mix( djbhash_read8( p ) ^ secret[1], djbhash_read8( p + 8 ) ^ seed );
+        see1 = djbhash_wy_mix( djbhash_read8( p + 16 ) ^ secret[2], djbhash_read8( p + 24 ) ^ see1 );
+        see2 = djbhash_wy_mix( djbhash_read8( p + 32 ) ^ secret[3], djbhash_read8( p + 40 ) ^ see2 );
+        p += 48;
+        i -= 48;
+      } while ( i > 48 );
+      seed ^= see1 ^ see2;
+    }
+    while ( i > 16 )
+    {
+      seed = djbhash_wy_mix( djbhash_read8( p ) ^ secret[1], djbhash_read8( p + 8 ) ^ seed );
+      i -= 16;
+      p += 16;
+    }
+    a = djbhash_read8( p + i - 16 );
+    b = djbhash_read8( p + i - 8 );
+  }
+  a ^= secret[1];
+  b ^= seed;
+  djbhash_mum( &a, &b );
+  return djbhash_wy_mix( a ^ secret[0] ^ length, b ^ secret[1] );
+}
+
+// Spread the bits of a hash value so both the slot index and the control byte are usable.
+static uint64_t djbhash_mix( uint64_t hash_value )
+{
+  hash_value ^= hash_value >> 33;
+  hash_value *= 0xff51afd7ed558ccdULL;
+  hash_value ^= hash_value >> 33;
+  hash_value *= 0xc4ceb9fe1a85ec53ULL;
+  hash_value ^= hash_value >> 33;
+  return hash_value;
+}
+
+// Bit mask of the bytes in a control group equal to `byte`.
+static inline unsigned int djbhash_group_match( const unsigned char *group, unsigned char byte )
+{
+#ifdef __SSE2__
+  __m128i ctrl = _mm_loadu_si128( ( const __m128i * )group );
+  return ( unsigned int )_mm_movemask_epi8( _mm_cmpeq_epi8( ctrl, _mm_set1_epi8( ( char )byte ) ) );
+#else
+  unsigned int i, mask;
+  mask = 0;
+  for ( i = 0; i < DJBHASH_GROUP_WIDTH; i++ )
+    if ( group[i] == byte )
+      mask |= 1u << i;
+  return mask;
+#endif
+}
+
+// Bit mask of the EMPTY or DELETED bytes in a control group (both have the high bit set).
+static inline unsigned int djbhash_group_match_free( const unsigned char *group )
+{
+#ifdef __SSE2__
+  return ( unsigned int )_mm_movemask_epi8( _mm_loadu_si128( ( const __m128i * )group ) );
+#else
+  unsigned int i, mask;
+  mask = 0;
+  for ( i = 0; i < DJBHASH_GROUP_WIDTH; i++ )
+    if ( group[i] & 0x80 )
+      mask |= 1u << i;
+  return mask;
+#endif
+}
+
+// Entries of the hash (the inline array while it's small).
+static inline struct djbhash_entry *djbhash_entries( struct djbhash *hash )
+{
+  return hash->entries != NULL ? hash->entries : hash->small;
+}
+
+// Whether a node with a matching hash has the key we're looking for.
+//   Keys interned in the same pool are equal exactly when their pointers are.
+static inline int djbhash_key_matches( struct djbhash_node *item, const void *key, size_t length )
+{
+  if ( length == DJBHASH_U64_LENGTH )
+    return ( item->flags & DJBHASH_NODE_U64 ) && memcmp( item->key, key, sizeof( uint64_t ) ) == 0;
+  return !( item->flags & DJBHASH_NODE_U64 ) && ( item->key == key || ( item->length == length && memcmp( item->key, key, length ) == 0 ) );
+}
+
+// Length to look up a node's own key with (DJBHASH_U64_LENGTH for number keys).
+static inline size_t djbhash_lookup_length( struct djbhash_node *item )
+{
+  return item->flags & DJBHASH_NODE_U64 ? DJBHASH_U64_LENGTH : item->length;
+}
+
+// Count a cache lookup, marking the item found (if any) as recently used. Returns the item.
+static inline struct djbhash_node *djbhash_cache_touch( struct djbhash *hash, struct djbhash_node *item )
+{
+  if ( hash->cache == NULL )
+    return item;
+  if ( item == NULL )
+  {
+    hash->cache->misses++;
+    return NULL;
+  }
+  hash->cache->hits++;
+  // Only write the flag when it changes, so hot items don't keep dirtying their node.
+  if ( !( item->flags & DJBHASH_NODE_REFERENCED ) )
+    item->flags |= DJBHASH_NODE_REFERENCED;
+  return item;
+}
+
+// Bytes per element of an array data type (0 for everything that isn't an array).
+static inline size_t djbhash_element_size( int data_type )
+{
+  switch ( data_type )
+  {
+    case DJBHASH_ARRAY:
+      return sizeof( int );
+    case DJBHASH_INT64_ARRAY:
+      return sizeof( int64_t );
+    case DJBHASH_FLOAT_ARRAY:
+      return sizeof( float );
+    case DJBHASH_DOUBLE_ARRAY:
+      return sizeof( double );
+    case DJBHASH_BYTES:
+      return sizeof( unsigned char );
+  }
+  return 0;
+}
+
+// Index of the lowest set bit.
+static inline unsigned int djbhash_ctz( unsigned int mask )
+{
+#ifdef __GNUC__
+  return ( unsigned int )__builtin_ctz( mask );
+#else
+  unsigned int i;
+  for ( i = 0; !( mask & 1u ); i++ )
+    mask >>= 1;
+  return i;
+#endif
+}
+
+// Number of leading zero bits in a group mask.
+static inline unsigned int djbhash_clz_group( unsigned int mask )
+{
+  unsigned int i;
+  for ( i = 0; i < DJBHASH_GROUP_WIDTH && !( mask & ( 1u << ( DJBHASH_GROUP_WIDTH - 1 - i ) ) ); i++ );
+  return i;
+}
+
+// Set a control byte, keeping the mirrored group after the table in sync.
+static inline void djbhash_set_ctrl( struct djbhash_table *table, unsigned int slot, unsigned char byte )
+{
+  table->ctrl[slot] = byte;
+  if ( slot < DJBHASH_GROUP_WIDTH )
+    table->ctrl[table->capacity + slot] = byte;
+}
+
+// Two digit pairs, used to format integers two digits at a time.
+static const char djbhash_digit_pairs[201] =
+  "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+  "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+  "8081828384858687888990919293949596979899";
+
+// Format an unsigned integer into `out` (at least 20 bytes); returns the number of characters.
+static inline int djbhash_format_uint( char *out, uint64_t number )
+{
+  char digits[20];
+  int pos, length;
+
+  pos = 20;
+  while ( number >= 100 )
+  {
+    pos -= 2;
+    memcpy( digits + pos, djbhash_digit_pairs + ( number % 100 ) * 2, 2 );
+    number /= 100;
+  }
+  if ( number >= 10 )
+  {
+    pos -= 2;
+    memcpy( digits + pos, djbhash_digit_pairs + number * 2, 2 );
+  } else
+  {
+    digits[--pos] = ( char )( '0' + number );
+  }
+  length = 20 - pos;
+  memcpy( out, digits + pos, length );
+  return length;
+}
+
+// Format a signed integer into `out` (at least 21 bytes); returns the number of characters.
+static inline int djbhash_format_int( char *out, int64_t number )
+{
+  if ( number < 0 )
+  {
+    out[0] = '-';
+    return djbhash_format_uint( out + 1, -( uint64_t )number ) + 1;
+  }
+  return djbhash_format_uint( out, ( uint64_t )number );
+}
+
+// Format a double into `out` (at least 32 bytes) with the fewest digits that read back the same value.
+//   Integral values keep a ".0" so they still read as doubles; inf and nan have no JSON form and become null.
+static inline int djbhash_format_double( char *out, double number )
+{
+  int precision, length;
+
+  if ( number != number || number - number != 0 )
+  {
+    memcpy( out, "null", 4 );
+    return 4;
+  }
+  // The range check comes first: casting a double outside int64_t's range is undefined.
+  if ( number < 1e15 && number > -1e15 && number == ( double )( int64_t )number )
+  {
+    length = djbhash_format_int( out, ( int64_t )number );
+    if ( number == 0 && 1 / number < 0 )
+    {
+      memcpy( out, "-0", 2 );
+      length = 2;
+    }
+    memcpy( out + length, ".0", 2 );
+    return length + 2;
+  }
+
+  for ( precision = 15; precision < 17; precision++ )
+  {
+    length = snprintf( out, 32, "%.*g", precision, number );
+    if ( strtod( out, NULL ) == number )
+      return length;
+  }
+  return snprintf( out, 32, "%.17g", number );
+}
+
+// Format a float into `out` (at least 32 bytes) with the fewest digits that read back as the same float.
+static inline int djbhash_format_float( char *out, float number )
+{
+  int precision, length;
+
+  // Integral values and inf / nan come out the same as doubles.
+  if ( number != number || number - number != 0 || ( number < 1e15f && number > -1e15f && number == ( float )( int64_t )number ) )
+    return djbhash_format_double( out, number );
+  for ( precision = 6; precision < 9; precision++ )
+  {
+    length = snprintf( out, 32, "%.*g", precision, number );
+    if ( strtof( out, NULL ) == number )
+      return length;
+  }
+  return snprintf( out, 32, "%.9g", number );
+}
+
+// Start a JSON writer that collects everything in one growing buffer.
+void djbhash_json_init( struct djbhash_json_writer *writer )
+{
+  writer->capacity = 256;
+  writer->data = malloc( sizeof( unsigned char ) * writer->capacity );
+  writer->length = 0;
+  writer->write = NULL;
+  writer->ctx = NULL;
+  writer->error = false;
+}
+
+// Start a JSON writer that hands its output to `write` every DJBHASH_JSON_BUFFER bytes.
+void djbhash_json_init_stream( struct djbhash_json_writer *writer, djbhash_json_write_fn write, void *ctx )
+{
+  writer->capacity = DJBHASH_JSON_BUFFER;
+  writer->data = malloc( sizeof( unsigned char ) * writer->capacity );
+  writer->length = 0;
+  writer->write = write;
+  writer->ctx = ctx;
+  writer->error = false;
+}
+
+// Hand buffered output to a streaming writer's callback.
+void djbhash_json_flush( struct djbhash_json_writer *writer )
+{
+  if ( writer->write != NULL && writer->length > 0 )
+  {
+    if ( !writer->error && !writer->write( writer->ctx, writer->data, writer->length ) )
+      writer->error = true;
+    writer->length = 0;
+  }
+}
+
+// Make room for `length` more bytes in the writer's buffer.
+static inline void djbhash_json_reserve( struct djbhash_json_writer *writer, size_t length )
+{
+  if ( writer->capacity - writer->length >= length )
+    return;
+  if ( writer->write != NULL )
+  {
+    djbhash_json_flush( writer );
+    if ( writer->capacity >= length )
+      return;
+  }
+  while ( writer->capacity - writer->length < length )
+    writer->capacity *= 2;
+  writer->data = realloc( writer->data, sizeof( unsigned char ) * writer->capacity );
+}
+
+// Append raw bytes to the output.
+void djbhash_json_append( struct djbhash_json_writer *writer, const void *data, size_t length )
+{
+  // Long runs bypass a streaming writer's buffer.
+  if ( writer->write != NULL && length > writer->capacity - writer->length )
+  {
+    djbhash_json_flush( writer );
+    if ( length >= writer->capacity )
+    {
+      if ( !writer->error && !writer->write( writer->ctx, data, length ) )
+        writer->error = true;
+      return;
+    }
+  }
+  djbhash_json_reserve( writer, length );
+  memcpy( writer->data + writer->length, data, length );
+  writer->length += length;
+}
+
+// Append a single character to the output.
+static inline void djbhash_json_put( struct djbhash_json_writer *writer, unsigned char c )
+{
+  djbhash_json_reserve( writer, 1 );
+  writer->data[writer->length++] = c;
+}
+
+// Write an integer.
+void djbhash_json_write_int( struct djbhash_json_writer *writer, int64_t number )
+{
+  djbhash_json_reserve( writer, 21 );
+  writer->length += djbhash_format_int( ( char * )writer->data + writer->length, number );
+}
+
+// Write a double.
+void djbhash_json_write_double( struct djbhash_json_writer *writer, double number )
+{
+  djbhash_json_reserve( writer, 32 );
+  writer->length += djbhash_format_double( ( char * )writer->data + writer->length, number );
+}
+
+// Number of bytes from the start of `data` that can be copied without escaping.
+static inline size_t djbhash_json_plain( const unsigned char *data, size_t length )
+{
+  size_t i;
+  unsigned int mask;
+
+  i = 0;
+#ifdef __SSE2__
+  // Control characters, quotes and backslashes, 16 bytes at a time.
+  __m128i quote, backslash, control, bytes;
+  quote = _mm_set1_epi8( '"' );
+  backslash = _mm_set1_epi8( '\\' );
+  control = _mm_set1_epi8( 0x1F );
+  for ( ; i + 16 <= length; i += 16 )
+  {
+    bytes = _mm_loadu_si128( ( const __m128i * )( data + i ) );
+    mask = ( unsigned int )_mm_movemask_epi8( _mm_or_si128( _mm_or_si128( _mm_cmpeq_epi8( bytes, quote ), _mm_cmpeq_epi8( bytes, backslash ) ), _mm_cmpeq_epi8( _mm_max_epu8( bytes, control ), control ) ) );
+    if ( mask )
+      return i + djbhash_ctz( mask );
+  }
+#endif
+  for ( ; i < length; i++ )
+  {
+    if ( data[i] < 0x20 || data[i] == '"' || data[i] == '\\' )
+      break;
+  }
+  return i;
+}
+
+// Write a quoted, escaped string.
+void djbhash_json_write_string( struct djbhash_json_writer *writer, const void *data, size_t length )
+{
+  const unsigned char *ptr;
+  size_t plain;
+  unsigned char escape[6];
+
+  ptr = ( const unsigned char * )data;
+  djbhash_json_put( writer, '"' );
+  while ( length > 0 )
+  {
+    plain = djbhash_json_plain( ptr, length );
+    djbhash_json_append( writer, ptr, plain );
+    ptr += plain;
+    length -= plain;
+    if ( length == 0 )
+      break;
+
+    escape[0] = '\\';
+    switch ( *ptr )
+    {
+      case '\n':
+        escape[1] = 'n';
+        break;
+      case '\t':
+        escape[1] = 't';
+        break;
+      case '\r':
+        escape[1] = 'r';
+        break;
+      case '\f':
+        escape[1] = 'f';
+        break;
+      case '\b':
+        escape[1] = 'b';
+        break;
+      case '"':
+      case '\\':
+        escape[1] = *ptr;
+        break;
+      default:
+        // Other control characters only have the \u form.
+        memcpy( escape + 1, "u00", 3 );
+        escape[4] = "0123456789abcdef"[*ptr >> 4];
+        escape[5] = "0123456789abcdef"[*ptr & 0x0F];
+        djbhash_json_append( writer, escape, 6 );
+        ptr++;
+        length--;
+        continue;
+    }
+    djbhash_json_append( writer, escape, 2 );
+    ptr++;
+    length--;
+  }
+  djbhash_json_put( writer, '"' );
+}
+
+// Write an int array.
+void djbhash_json_write_array( struct djbhash_json_writer *writer, int *array, int count )
+{
+  djbhash_json_write_typed_array( writer, array, DJBHASH_ARRAY, count );
+}
+
+// Write an array of any array data type. Room is reserved for DJBHASH_JSON_BLOCK elements at a time,
+//   which are then formatted straight into the buffer.
+void djbhash_json_write_typed_array( struct djbhash_json_writer *writer, const void *array, int data_type, int count )
+{
+  char *out;
+  int i, end;
+
+  djbhash_json_put( writer, '[' );
+  for ( i = 0; i < count; )
+  {
+    end = count - i > DJBHASH_JSON_BLOCK ? i + DJBHASH_JSON_BLOCK : count;
+    djbhash_json_reserve( writer, ( size_t )( end - i ) * 33 );
+    out = ( char * )writer->data + writer->length;
+    for ( ; i < end; i++ )
+    {
+      if ( i > 0 )
+        *out++ = ',';
+      switch ( data_type )
+      {
+        case DJBHASH_ARRAY:
+          out += djbhash_format_int( out, ( ( const int * )array )[i] );
+          break;
+        case DJBHASH_INT64_ARRAY:
+          out += djbhash_format_int( out, ( ( const int64_t * )array )[i] );
+          break;
+        case DJBHASH_FLOAT_ARRAY:
+          out += djbhash_format_float( out, ( ( const float * )array )[i] );
+          break;
+        case DJBHASH_DOUBLE_ARRAY:
+          out += djbhash_format_double( out, ( ( const double * )array )[i] );
+          break;
+        default:
+          out += djbhash_format_uint( out, ( ( const unsigned char * )array )[i] );
+      }
+    }
+    writer->length = ( unsigned char * )out - writer->data;
+  }
+  djbhash_json_put( writer, ']' );
+}
+
+// Write an item's value.
+void djbhash_json_write_value( struct djbhash_json_writer *writer, struct djbhash_node *item )
+{
+  switch ( item->data_type )
+  {
+    case DJBHASH_INT:
+      djbhash_json_write_int( writer, *( int * )item->value );
+      break;
+    case DJBHASH_DOUBLE:
+      djbhash_json_write_double( writer, *( double * )item->value );
+      break;
+    case DJBHASH_CHAR:
+      djbhash_json_write_string( writer, item->value, 1 );
+      break;
+    case DJBHASH_STRING:
+      djbhash_json_write_string( writer, item->value, strlen( ( char * )item->value ) );
+      break;
+    case DJBHASH_ARRAY:
+    case DJBHASH_INT64_ARRAY:
+    case DJBHASH_FLOAT_ARRAY:
+    case DJBHASH_DOUBLE_ARRAY:
+    case DJBHASH_BYTES:
+      djbhash_json_write_typed_array( writer, item->value, item->data_type, item->count );
+      break;
+    case DJBHASH_HASH:
+      djbhash_json_write_hash( writer, ( struct djbhash * )item->value );
+      break;
+    default:
+      // A null loaded from JSON is an OTHER item without a value.
+      if ( item->value == NULL )
+        djbhash_json_append( writer, "null", 4 );
+      else
+        djbhash_json_append( writer, "UNKNOWN", 7 );
+  }
+}
+
+// Write a hash as a JSON object; nested hashes are written in place.
+void djbhash_json_write_hash( struct djbhash_json_writer *writer, struct djbhash *hash )
+{
+  struct djbhash_node *iter;
+  struct djbhash_cursor cursor;
+  char text[20];
+
+  djbhash_json_put( writer, '{' );
+  djbhash_cursor_init( hash, &cursor );
+  iter = djbhash_cursor_next( hash, &cursor );
+  while ( iter )
+  {
+    // Number keys are written as their decimal text.
+    if ( iter->flags & DJBHASH_NODE_U64 )
+      djbhash_json_write_string( writer, text, djbhash_format_uint( text, djbhash_key_u64( iter ) ) );
+    else
+      djbhash_json_write_string( writer, iter->key, iter->length );
+    djbhash_json_put( writer, ':' );
+    djbhash_json_write_value( writer, iter );
+    iter = djbhash_cursor_next( hash, &cursor );
+    if ( iter != NULL )
+      djbhash_json_put( writer, ',' );
+  }
+  djbhash_json_put( writer, '}' );
+}
+
+// Finish a JSON writer: flush a stream, or NUL terminate a buffer and hand it over.
+//   Returns the buffer (NULL for streams, which get their memory freed) and sets `ok` if nothing failed.
+unsigned char *djbhash_json_finish( struct djbhash_json_writer *writer, int *ok )
+{
+  unsigned char *json;
+
+  if ( writer->write != NULL )
+  {
+    djbhash_json_flush( writer );
+    free( writer->data );
+    json = NULL;
+  } else
+  {
+    djbhash_json_reserve( writer, 1 );
+    writer->data[writer->length] = '\0';
+    json = writer->data;
+  }
+  if ( ok != NULL )
+    *ok = !writer->error;
+  writer->data = NULL;
+  writer->length = 0;
+  writer->capacity = 0;
+  return json;
+}
 
 // Convert an integer to string.
 unsigned char *djbhash_int_to_a( int number )
 {
-  unsigned char *ascii;
-  ascii = calloc( 32, sizeof( unsigned char ) );
-  sprintf( ascii, "%d", number );
-  return ascii;
+  unsigned char *ascii;
+  ascii = calloc( 32, sizeof( unsigned char ) );
+  djbhash_format_int( ( char * )ascii, number );
+  return ascii;
+}
+
+// Convert a double into a string.
+unsigned char *djbhash_double_to_a( double number )
+{
+  unsigned char *ascii;
+  ascii = calloc( 33, sizeof( unsigned char ) );
+  djbhash_format_double( ( char * )ascii, number );
+  return ascii;
+}
+
+// Return a JSON formated array string.
+unsigned char *djbhash_json_array( int *array, int count )
+{
+  struct djbhash_json_writer writer;
+
+  djbhash_json_init( &writer );
+  djbhash_json_write_array( &writer, array, count );
+  return djbhash_json_finish( &writer, NULL );
+}
+
+// Return an escaped version of a string.
+unsigned char *djbhash_escaped( unsigned char *data )
+{
+  struct djbhash_json_writer writer;
+
+  djbhash_json_init( &writer );
+  djbhash_json_write_string( &writer, data, strlen( ( char * )data ) );
+  return djbhash_json_finish( &writer, NULL );
+}
+
+// Print an item in JSON format.
+unsigned char *djbhash_value_to_json( struct djbhash_node *item )
+{
+  struct djbhash_json_writer writer;
+
+  djbhash_json_init( &writer );
+  djbhash_json_write_value( &writer, item );
+  return djbhash_json_finish( &writer, NULL );
+}
+
+// Return a JSON formatted string containing the hash.
+unsigned char *djbhash_to_json( struct djbhash *hash )
+{
+  struct djbhash_json_writer writer;
+
+  djbhash_json_init( &writer );
+  djbhash_json_write_hash( &writer, hash );
+  return djbhash_json_finish( &writer, NULL );
+}
+
+// Stream a hash as JSON through a write callback; returns false if a write failed.
+int djbhash_to_json_stream( struct djbhash *hash, djbhash_json_write_fn write, void *ctx )
+{
+  struct djbhash_json_writer writer;
+  int ok;
+
+  djbhash_json_init_stream( &writer, write, ctx );
+  djbhash_json_write_hash( &writer, hash );
+  djbhash_json_finish( &writer, &ok );
+  return ok;
+}
+
+// Write callback for a file descriptor (passed as an intptr_t in `ctx`).
+static int djbhash_json_write_fd( void *ctx, const void *data, size_t length )
+{
+  ssize_t written;
+
+  while ( length > 0 )
+  {
+    written = write( ( int )( intptr_t )ctx, data, length );
+    if ( written < 0 )
+    {
+      if ( errno == EINTR )
+        continue;
+      return false;
+    }
+    data = ( const unsigned char * )data + written;
+    length -= written;
+  }
+  return true;
+}
+
+// Stream a hash as JSON to a file descriptor; returns false if a write failed.
+int djbhash_to_json_fd( struct djbhash *hash, int fd )
+{
+  return djbhash_to_json_stream( hash, djbhash_json_write_fd, ( void * )( intptr_t )fd );
+}
+
+// Make room for `length` bytes of decoded output in the parser's scratch buffer.
+static inline void djbhash_json_scratch( struct djbhash_json_parser *parser, size_t length )
+{
+  if ( parser->scratch_size >= length )
+    return;
+  if ( parser->scratch_size == 0 )
+    parser->scratch_size = 256;
+  while ( parser->scratch_size < length )
+    parser->scratch_size *= 2;
+  parser->scratch = realloc( parser->scratch, parser->scratch_size );
+}
+
+// Skip whitespace between tokens.
+static inline void djbhash_json_skip( struct djbhash_json_parser *parser )
+{
+  while ( parser->pos < parser->end && ( *parser->pos == ' ' || *parser->pos == '\n' || *parser->pos == '\r' || *parser->pos == '\t' ) )
+    parser->pos++;
+}
+
+// Read the 4 hex digits of a \u escape; returns -1 if they aren't hex.
+static inline long djbhash_json_hex4( const unsigned char *ptr )
+{
+  int i;
+  long code;
+
+  code = 0;
+  for ( i = 0; i < 4; i++ )
+  {
+    code <<= 4;
+    if ( ptr[i] >= '0' && ptr[i] <= '9' )
+      code |= ptr[i] - '0';
+    else if ( ( ptr[i] | 0x20 ) >= 'a' && ( ptr[i] | 0x20 ) <= 'f' )
+      code |= ( ptr[i] | 0x20 ) - 'a' + 10;
+    else
+      return -1;
+  }
+  return code;
+}
+
+// Parse a string. Without `copy`, a string with no escapes is returned in place (not NUL terminated);
+//   otherwise it's decoded into the scratch buffer and NUL terminated.
+static int djbhash_json_parse_string( struct djbhash_json_parser *parser, const char **out, size_t *length, int copy )
+{
+  const unsigned char *start;
+  size_t plain, used;
+  long code, low;
+  unsigned char escape;
+  char *dest;
+
+  start = ++parser->pos;
+  plain = djbhash_json_plain( start, parser->end - start );
+  parser->pos += plain;
+  if ( parser->pos >= parser->end )
+    return false;
+  if ( *parser->pos == '"' && !copy )
+  {
+    parser->pos++;
+    *out = ( const char * )start;
+    *length = plain;
+    return true;
+  }
+
+  djbhash_json_scratch( parser, plain + 1 );
+  memcpy( parser->scratch, start, plain );
+  used = plain;
+  while ( *parser->pos != '"' )
+  {
+    // Raw control characters aren't allowed inside strings.
+    if ( *parser->pos != '\\' || parser->end - parser->pos < 2 )
+      return false;
+    escape = parser->pos[1];
+    parser->pos += 2;
+    djbhash_json_scratch( parser, used + 5 );
+    dest = parser->scratch + used;
+    switch ( escape )
+    {
+      case 'n':
+        *dest = '\n';
+        break;
+      case 't':
+        *dest = '\t';
+        break;
+      case 'r':
+        *dest = '\r';
+        break;
+      case 'f':
+        *dest = '\f';
+        break;
+      case 'b':
+        *dest = '\b';
+        break;
+      case '"':
+      case '\\':
+      case '/':
+        *dest = escape;
+        break;
+      case 'u':
+        if ( parser->end - parser->pos < 4 || ( code = djbhash_json_hex4( parser->pos ) ) < 0 )
+          return false;
+        parser->pos += 4;
+        // Characters outside the BMP come as a surrogate pair.
+        if ( code >= 0xD800 && code <= 0xDFFF )
+        {
+          if ( code > 0xDBFF || parser->end - parser->pos < 6 || parser->pos[0] != '\\' || parser->pos[1] != 'u' )
+            return false;
+          low = djbhash_json_hex4( parser->pos + 2 );
+          if ( low < 0xDC00 || low > 0xDFFF )
+            return false;
+          parser->pos += 6;
+          code = 0x10000 + ( ( code - 0xD800 ) << 10 ) + ( low - 0xDC00 );
+        }
+        // UTF-8 encode the code point.
+        if ( code < 0x80 )
+        {
+          *dest = ( char )code;
+        } else if ( code < 0x800 )
+        {
+          dest[0] = ( char )( 0xC0 | ( code >> 6 ) );
+          dest[1] = ( char )( 0x80 | ( code & 0x3F ) );
+          used++;
+        } else if ( code < 0x10000 )
+        {
+          dest[0] = ( char )( 0xE0 | ( code >> 12 ) );
+          dest[1] = ( char )( 0x80 | ( ( code >> 6 ) & 0x3F ) );
+          dest[2] = ( char )( 0x80 | ( code & 0x3F ) );
+          used += 2;
+        } else
+        {
+          dest[0] = ( char )( 0xF0 | ( code >> 18 ) );
+          dest[1] = ( char )( 0x80 | ( ( code >> 12 ) & 0x3F ) );
+          dest[2] = ( char )( 0x80 | ( ( code >> 6 ) & 0x3F ) );
+          dest[3] = ( char )( 0x80 | ( code & 0x3F ) );
+          used += 3;
+        }
+        break;
+      default:
+        return false;
+    }
+    used++;
+
+    // Copy the next run of plain characters.
+    plain = djbhash_json_plain( parser->pos, parser->end - parser->pos );
+    djbhash_json_scratch( parser, used + plain + 1 );
+    memcpy( parser->scratch + used, parser->pos, plain );
+    used += plain;
+    parser->pos += plain;
+    if ( parser->pos >= parser->end )
+      return false;
+  }
+  parser->pos++;
+  parser->scratch[used] = '\0';
+  *out = parser->scratch;
+  *length = used;
+  return true;
+}
+
+// Parse a number into `i` (integers that fit an int) or `d`; returns the data type, or -1 if it's malformed.
+static int djbhash_json_parse_number( struct djbhash_json_parser *parser, int *i, double *d )
+{
+  const unsigned char *start, *digits;
+  int integral;
+  int64_t value;
+  char buffer[64], *copy;
+
+  start = parser->pos;
+  if ( parser->pos < parser->end && *parser->pos == '-' )
+    parser->pos++;
+  digits = parser->pos;
+  value = 0;
+  while ( parser->pos < parser->end && *parser->pos >= '0' && *parser->pos <= '9' )
+  {
+    if ( parser->pos - digits < 11 )
+      value = value * 10 + ( *parser->pos - '0' );
+    parser->pos++;
+  }
+  // At least one digit, and no leading zeros.
+  if ( parser->pos == digits || ( *digits == '0' && parser->pos - digits > 1 ) )
+    return -1;
+
+  integral = true;
+  if ( parser->pos < parser->end && *parser->pos == '.' )
+  {
+    integral = false;
+    digits = ++parser->pos;
+    while ( parser->pos < parser->end && *parser->pos >= '0' && *parser->pos <= '9' )
+      parser->pos++;
+    if ( parser->pos == digits )
+      return -1;
+  }
+  if ( parser->pos < parser->end && ( *parser->pos == 'e' || *parser->pos == 'E' ) )
+  {
+    integral = false;
+    parser->pos++;
+    if ( parser->pos < parser->end && ( *parser->pos == '+' || *parser->pos == '-' ) )
+      parser->pos++;
+    digits = parser->pos;
+    while ( parser->pos < parser->end && *parser->pos >= '0' && *parser->pos <= '9' )
+      parser->pos++;
+    if ( parser->pos == digits )
+      return -1;
+  }
+
+  if ( integral && parser->pos - start <= 11 )
+  {
+    if ( *start == '-' )
+      value = -value;
+    if ( value >= INT_MIN && value <= INT_MAX )
+    {
+      *i = ( int )value;
+      return DJBHASH_INT;
+    }
+  }
+
+  // The input needn't be NUL terminated, so strtod gets a copy (on the heap for very long numerals).
+  copy = parser->pos - start < ( long )sizeof( buffer ) ? buffer : malloc( parser->pos - start + 1 );
+  if ( copy == NULL )
+    return -1;
+  memcpy( copy, start, parser->pos - start );
+  copy[parser->pos - start] = '\0';
+  *d = strtod( copy, NULL );
+  if ( copy != buffer )
+    free( copy );
+  return DJBHASH_DOUBLE;
+}
+
+// Store a parsed value under a key.
+static inline struct djbhash_node *djbhash_json_store( struct djbhash *hash, const char *key, size_t length, void *value, int data_type, int count )
+{
+  uint64_t hash_value;
+
+  hash_value = djbhash_hash_key( hash, key, length );
+  djbhash_set_hashed( hash, key, length, hash_value, value, data_type, count );
+  return djbhash_find_hashed( hash, key, length, hash_value );
+}
+
+// Store an empty nested hash under a key and return it, ready to be filled in place.
+static inline struct djbhash *djbhash_json_child( struct djbhash *hash, const char *key, size_t length )
+{
+  struct djbhash empty;
+
+  djbhash_init( &empty );
+  djbhash_set_hash_function( &empty, hash->hash_function, hash->seed );
+  empty.intern = hash->intern;
+  return ( struct djbhash * )djbhash_json_store( hash, key, length, &empty, DJBHASH_HASH, 0 )->value;
+}
+
+static int djbhash_json_parse_value( struct djbhash_json_parser *parser, struct djbhash *hash, const char *key, size_t length );
+
+// Parse an object's members into `hash`.
+static int djbhash_json_parse_object( struct djbhash_json_parser *parser, struct djbhash *hash )
+{
+  const char *key;
+  char *copy;
+  size_t length;
+  int ok;
+
+  if ( ++parser->depth > DJBHASH_JSON_MAX_DEPTH )
+    return false;
+  parser->pos++;
+  djbhash_json_skip( parser );
+  if ( parser->pos < parser->end && *parser->pos == '}' )
+  {
+    parser->pos++;
+    parser->depth--;
+    return true;
+  }
+
+  while ( true )
+  {
+    djbhash_json_skip( parser );
+    if ( parser->pos >= parser->end || *parser->pos != '"' || !djbhash_json_parse_string( parser, &key, &length, false ) )
+      return false;
+
+    // Decoded keys live in the scratch buffer, which the value is about to reuse.
+    copy = NULL;
+    if ( key == parser->scratch )
+    {
+      copy = malloc( length + 1 );
+      memcpy( copy, key, length + 1 );
+      key = copy;
+    }
+
+    djbhash_json_skip( parser );
+    ok = parser->pos < parser->end && *parser->pos++ == ':' && djbhash_json_parse_value( parser, hash, key, length );
+    free( copy );
+    if ( !ok )
+      return false;
+
+    djbhash_json_skip( parser );
+    if ( parser->pos >= parser->end )
+      return false;
+    if ( *parser->pos == '}' )
+      break;
+    if ( *parser->pos++ != ',' )
+      return false;
+  }
+  parser->pos++;
+  parser->depth--;
+  return true;
+}
+
+// Parse an array: all ints become a DJBHASH_ARRAY, numbers that aren't all ints a DJBHASH_DOUBLE_ARRAY,
+//   anything else a nested hash keyed "0", "1", ...
+static int djbhash_json_parse_array( struct djbhash_json_parser *parser, struct djbhash *hash, const char *key, size_t length )
+{
+  struct djbhash *child;
+  const unsigned char *start, *first;
+  size_t count, i;
+  int number, type, doubles;
+  double d;
+  char index[24];
+
+  if ( ++parser->depth > DJBHASH_JSON_MAX_DEPTH )
+    return false;
+  parser->pos++;
+  child = NULL;
+  count = 0;
+  doubles = false;
+  djbhash_json_skip( parser );
+  if ( parser->pos < parser->end && *parser->pos == ']' )
+  {
+    parser->pos++;
+    parser->depth--;
+    djbhash_json_store( hash, key, length, parser->ints, DJBHASH_ARRAY, 0 );
+    return true;
+  }
+  first = parser->pos;
+
+  while ( true )
+  {
+    djbhash_json_skip( parser );
+    if ( parser->pos >= parser->end )
+      return false;
+
+    // Collect numbers until something else shows up.
+    if ( child == NULL )
+    {
+      start = parser->pos;
+      if ( ( *start == '-' || ( *start >= '0' && *start <= '9' ) ) && ( type = djbhash_json_parse_number( parser, &number, &d ) ) >= 0 )
+      {
+        if ( ( doubles || type == DJBHASH_DOUBLE ) && count >= parser->doubles_size )
+        {
+          parser->doubles_size = count >= 32 ? count * 2 : 64;
+          parser->doubles = realloc( parser->doubles, sizeof( double ) * parser->doubles_size );
+        }
+        // The first non-int turns the ints collected so far into doubles.
+        if ( type == DJBHASH_DOUBLE && !doubles )
+        {
+          for ( i = 0; i < count; i++ )
+            parser->doubles[i] = parser->ints[i];
+          doubles = true;
+        }
+        if ( doubles )
+        {
+          parser->doubles[count++] = type == DJBHASH_INT ? number : d;
+        } else
+        {
+          if ( count == parser->ints_size )
+          {
+            parser->ints_size = parser->ints_size ? parser->ints_size * 2 : 64;
+            parser->ints = realloc( parser->ints, sizeof( int ) * parser->ints_size );
+          }
+          parser->ints[count++] = number;
+        }
+      } else
+      {
+        // Start over from the first element, parsing each one as a value of its own.
+        parser->pos = first;
+        count = 0;
+        child = djbhash_json_child( hash, key, length );
+      }
+    }
+    if ( child != NULL )
+    {
+      if ( !djbhash_json_parse_value( parser, child, index, djbhash_format_uint( index, count ) ) )
+        return false;
+      count++;
+    }
+
+    djbhash_json_skip( parser );
+    if ( parser->pos >= parser->end )
+      return false;
+    if ( *parser->pos == ']' )
+      break;
+    if ( *parser->pos++ != ',' )
+      return false;
+  }
+  parser->pos++;
+  parser->depth--;
+  if ( child == NULL && doubles )
+    djbhash_json_store( hash, key, length, parser->doubles, DJBHASH_DOUBLE_ARRAY, ( int )count );
+  else if ( child == NULL )
+    djbhash_json_store( hash, key, length, parser->ints, DJBHASH_ARRAY, ( int )count );
+  return true;
+}
+
+// Parse a value and store it under a key.
+static int djbhash_json_parse_value( struct djbhash_json_parser *parser, struct djbhash *hash, const char *key, size_t length )
+{
+  const char *string;
+  size_t string_length;
+  int number, type;
+  double d;
+
+  djbhash_json_skip( parser );
+  if ( parser->pos >= parser->end )
+    return false;
+  switch ( *parser->pos )
+  {
+    case '{':
+      return djbhash_json_parse_object( parser, djbhash_json_child( hash, key, length ) );
+    case '[':
+      return djbhash_json_parse_array( parser, hash, key, length );
+    case '"':
+      if ( !djbhash_json_parse_string( parser, &string, &string_length, true ) )
+        return false;
+      djbhash_json_store( hash, key, length, ( void * )string, DJBHASH_STRING, 0 );
+      return true;
+    case 't':
+    case 'f':
+      number = *parser->pos == 't';
+      string = number ? "true" : "false";
+      string_length = strlen( string );
+      if ( parser->end - parser->pos < ( long )string_length || memcmp( parser->pos, string, string_length ) != 0 )
+        return false;
+      parser->pos += string_length;
+      djbhash_json_store( hash, key, length, &number, DJBHASH_INT, 0 );
+      return true;
+    case 'n':
+      if ( parser->end - parser->pos < 4 || memcmp( parser->pos, "null", 4 ) != 0 )
+        return false;
+      parser->pos += 4;
+      djbhash_json_store( hash, key, length, NULL, DJBHASH_OTHER, 0 );
+      return true;
+    default:
+      if ( ( type = djbhash_json_parse_number( parser, &number, &d ) ) < 0 )
+        return false;
+      djbhash_json_store( hash, key, length, type == DJBHASH_INT ? ( void * )&number : ( void * )&d, type, 0 );
+      return true;
+  }
+}
+
+// Parse a JSON object into `hash`; on failure it holds whatever was loaded before the error.
+static int djbhash_json_load( struct djbhash *hash, const char *json, size_t length )
+{
+  struct djbhash_json_parser parser;
+  int ok;
+
+  parser.pos = ( const unsigned char * )json;
+  parser.end = parser.pos + length;
+  parser.scratch = NULL;
+  parser.scratch_size = 0;
+  parser.ints = NULL;
+  parser.ints_size = 0;
+  parser.doubles = NULL;
+  parser.doubles_size = 0;
+  parser.depth = 0;
+
+  djbhash_json_skip( &parser );
+  ok = parser.pos < parser.end && *parser.pos == '{' && djbhash_json_parse_object( &parser, hash );
+  djbhash_json_skip( &parser );
+  if ( parser.pos != parser.end )
+    ok = false;
+
+  free( parser.scratch );
+  free( parser.ints );
+  free( parser.doubles );
+  return ok;
+}
+
+// Load a JSON object into an initialized hash (on top of what it already holds).
+//   Returns false on malformed input, leaving the hash as it was.
+int djbhash_from_json( struct djbhash *hash, const char *json, size_t length )
+{
+  struct djbhash staging;
+  struct djbhash_cursor cursor;
+  struct djbhash_node *item;
+  int ok;
+
+  if ( hash->map != NULL )
+    return false;
+
+  // An empty hash is loaded into directly (and emptied again on failure). Otherwise the items are loaded
+  //   into a hash of their own first, and only copied over once the whole input has parsed.
+  if ( hash->count == 0 )
+  {
+    if ( !djbhash_json_load( hash, json, length ) )
+    {
+      djbhash_empty( hash );
+      return false;
+    }
+
+    // Nested hashes were filled after they were set, so a cache counts them again now.
+    if ( hash->cache != NULL )
+    {
+      djbhash_cursor_init( hash, &cursor );
+      while ( ( item = djbhash_cursor_next( hash, &cursor ) ) != NULL )
+      {
+        if ( item->data_type == DJBHASH_HASH )
+          djbhash_cache_charge( hash, item );
+      }
+      djbhash_cache_evict( hash, NULL );
+    }
+    return true;
+  }
+
+  djbhash_init( &staging );
+  djbhash_set_hash_function( &staging, hash->hash_function, hash->seed );
+  staging.intern = hash->intern;
+  ok = djbhash_json_load( &staging, json, length );
+  djbhash_cursor_init( &staging, &cursor );
+  while ( ok && ( item = djbhash_cursor_next( &staging, &cursor ) ) != NULL )
+    djbhash_set_hashed( hash, item->key, item->length, item->hash, item->value, item->data_type, item->count );
+  djbhash_destroy( &staging );
+  return ok;
+}
+
+// Load a JSON file into an initialized hash; returns false if it can't be read or parsed.
+int djbhash_from_json_file( struct djbhash *hash, const char *path )
+{
+  FILE *file;
+  char *json;
+  long length;
+  int ok;
+
+  if ( ( file = fopen( path, "rb" ) ) == NULL )
+    return false;
+  if ( fseek( file, 0, SEEK_END ) != 0 || ( length = ftell( file ) ) < 0 || fseek( file, 0, SEEK_SET ) != 0 )
+  {
+    fclose( file );
+    return false;
+  }
+  json = malloc( length + 1 );
+  ok = fread( json, 1, length, file ) == ( size_t )length;
+  fclose( file );
+  if ( ok )
+    ok = djbhash_from_json( hash, json, length );
+  free( json );
+  return ok;
+}
+
+// Print an items' data.
+void djbhash_print_value( struct djbhash_node *item )
+{
+  // String containing JSON formatted value.
+  unsigned char *json;
+
+  json = djbhash_value_to_json( item );
+  printf( "%s", json );
+  if ( json != NULL )
+  {
+    free( json );
+    json = NULL;
+  }
+  printf( "\n" );
+}
+
+// Print the key value pair.
+void djbhash_print( struct djbhash_node *item )
+{
+  if ( item->flags & DJBHASH_NODE_U64 )
+    printf( "%llu => ", ( unsigned long long )djbhash_key_u64( item ) );
+  else
+    printf( "%s => ", item->key );
+  djbhash_print_value( item );
+}
+
+// Find the slot holding the element in one table.
+static struct djbhash_search djbhash_table_probe( struct djbhash *hash, struct djbhash_table *table, uint64_t hash_value, const void *key, size_t length )
+{
+  // Mixed hash, control byte tag and probe position.
+  uint64_t mixed;
+  unsigned char tag;
+  unsigned int mask, pos, match, slot;
+  // Candidate entry.
+  struct djbhash_entry *entry;
+  // Return variable.
+  struct djbhash_search search;
+
+  mixed = djbhash_mix( hash_value );
+  tag = ( unsigned char )( mixed >> 57 );
+  mask = table->capacity - 1;
+  pos = ( unsigned int )mixed & mask;
+  while ( true )
+  {
+    DJBHASH_COUNT( hash->stat_probes );
+    match = djbhash_group_match( table->ctrl + pos, tag );
+    while ( match )
+    {
+      slot = ( pos + djbhash_ctz( match ) ) & mask;
+      entry = &hash->entries[table->slots[slot]];
+      // We want to return if the key actually matches; the cached hash weeds out most misses.
+      if ( entry->hash == hash_value && djbhash_key_matches( entry->node, key, length ) )
+      {
+        search.table = table;
+        search.slot = slot;
+        search.entry = table->slots[slot];
+        search.found = true;
+        search.item = entry->node;
+        return search;
+      }
+      match &= match - 1;
+    }
+
+    // An EMPTY slot ends the probe sequence: the item doesn't exist.
+    if ( djbhash_group_match( table->ctrl + pos, DJBHASH_CTRL_EMPTY ) )
+      break;
+    pos = ( pos + DJBHASH_GROUP_WIDTH ) & mask;
+  }
+
+  search.table = NULL;
+  search.slot = 0;
+  search.entry = 0;
+  search.found = false;
+  search.item = NULL;
+  return search;
+}
+
+// Find the element in the hash, looking in the table being drained as well.
+static struct djbhash_search djbhash_probe( struct djbhash *hash, uint64_t hash_value, const void *key, size_t length )
+{
+  unsigned int i;
+  struct djbhash_search search;
+
+  DJBHASH_COUNT( hash->stat_lookups );
+
+  // Small hashes are just scanned.
+  if ( hash->table.capacity == 0 )
+  {
+    DJBHASH_COUNT( hash->stat_probes );
+    search.table = NULL;
+    search.slot = 0;
+    for ( i = 0; i < hash->entries_used; i++ )
+    {
+      if ( hash->small[i].hash == hash_value && djbhash_key_matches( hash->small[i].node, key, length ) )
+      {
+        search.entry = i;
+        search.found = true;
+        search.item = hash->small[i].node;
+        return search;
+      }
+    }
+    search.entry = 0;
+    search.found = false;
+    search.item = NULL;
+    DJBHASH_COUNT( hash->stat_misses );
+    return search;
+  }
+
+  search = djbhash_table_probe( hash, &hash->table, hash_value, key, length );
+  if ( !search.found && hash->old.count > 0 )
+    search = djbhash_table_probe( hash, &hash->old, hash_value, key, length );
+  if ( !search.found )
+    DJBHASH_COUNT( hash->stat_misses );
+  return search;
+}
+
+// Find the first EMPTY or DELETED slot along the probe sequence for a hash.
+static unsigned int djbhash_insert_slot( struct djbhash_table *table, uint64_t mixed )
+{
+  unsigned int mask, pos, match;
+
+  mask = table->capacity - 1;
+  pos = ( unsigned int )mixed & mask;
+  while ( !( match = djbhash_group_match_free( table->ctrl + pos ) ) )
+    pos = ( pos + DJBHASH_GROUP_WIDTH ) & mask;
+  return ( pos + djbhash_ctz( match ) ) & mask;
+}
+
+// Point a slot of a table (known not to contain the key) at an entry.
+static void djbhash_table_insert( struct djbhash_table *table, uint64_t hash_value, unsigned int entry )
+{
+  uint64_t mixed;
+  unsigned int slot;
+
+  mixed = djbhash_mix( hash_value );
+  slot = djbhash_insert_slot( table, mixed );
+  if ( table->ctrl[slot] == DJBHASH_CTRL_EMPTY )
+    table->growth_left--;
+  djbhash_set_ctrl( table, slot, ( unsigned char )( mixed >> 57 ) );
+  table->slots[slot] = entry;
+  table->count++;
+}
+
+// Take a slot out of a table.
+static void djbhash_table_erase( struct djbhash_table *table, unsigned int slot )
+{
+  unsigned int mask, before;
+  unsigned int empty_after, empty_before;
+
+  // If no probe window could have seen this slot full, it can go straight back to EMPTY.
+  //   Otherwise leave a DELETED marker so later probes keep walking past it.
+  mask = table->capacity - 1;
+  before = ( slot - DJBHASH_GROUP_WIDTH ) & mask;
+  empty_after = djbhash_group_match( table->ctrl + slot, DJBHASH_CTRL_EMPTY );
+  empty_before = djbhash_group_match( table->ctrl + before, DJBHASH_CTRL_EMPTY );
+  if ( empty_after && empty_before && djbhash_ctz( empty_after ) + djbhash_clz_group( empty_before ) < DJBHASH_GROUP_WIDTH )
+  {
+    djbhash_set_ctrl( table, slot, DJBHASH_CTRL_EMPTY );
+    table->growth_left++;
+  } else
+  {
+    djbhash_set_ctrl( table, slot, DJBHASH_CTRL_DELETED );
+  }
+  table->count--;
+}
+
+// Move up to `slots` slots worth of items from the table being drained into the current one.
+static void djbhash_migrate( struct djbhash *hash, unsigned int slots )
+{
+  unsigned int end, entry;
+
+  if ( hash->old.capacity == 0 )
+    return;
+
+  end = hash->migrate_pos + slots;
+  if ( end > hash->old.capacity || end < hash->migrate_pos )
+    end = hash->old.capacity;
+  for ( ; hash->migrate_pos < end && hash->old.count > 0; hash->migrate_pos++ )
+  {
+    if ( hash->old.ctrl[hash->migrate_pos] & 0x80 )
+      continue;
+    entry = hash->old.slots[hash->migrate_pos];
+    djbhash_table_insert( &hash->table, hash->entries[entry].hash, entry );
+    djbhash_set_ctrl( &hash->old, hash->migrate_pos, DJBHASH_CTRL_DELETED );
+    hash->old.count--;
+  }
+
+  // Once everything has moved over the old table can go.
+  if ( hash->old.count == 0 )
+  {
+    djbhash_table_free( &hash->old );
+    hash->migrate_pos = 0;
+  }
+}
+
+// Start moving items into a new table; the move itself happens a few slots per write.
+static void djbhash_grow( struct djbhash *hash, unsigned int capacity )
+{
+  // Only one table can be draining at a time.
+  djbhash_migrate( hash, UINT_MAX );
+
+  hash->old = hash->table;
+  hash->migrate_pos = 0;
+  djbhash_table_alloc( &hash->table, capacity );
+  if ( hash->old.count == 0 )
+    djbhash_table_free( &hash->old );
+}
+
+// Squeeze removed entries out of the entry array and rebuild the slot table to match.
+static void djbhash_compact( struct djbhash *hash )
+{
+  unsigned int i, used, hand;
+
+  djbhash_migrate( hash, UINT_MAX );
+
+  used = 0;
+  hand = UINT_MAX;
+  for ( i = 0; i < hash->entries_used; i++ )
+  {
+    // A cache's clock hand moves along with the entry it points at.
+    if ( hash->cache != NULL && i == hash->cache->hand )
+      hand = used;
+    if ( hash->entries[i].node != NULL )
+      hash->entries[used++] = hash->entries[i];
+  }
+  hash->entries_used = used;
+  if ( hash->cache != NULL )
+    hash->cache->hand = hand != UINT_MAX ? hand : 0;
+
+  memset( hash->table.ctrl, DJBHASH_CTRL_EMPTY, hash->table.capacity + DJBHASH_GROUP_WIDTH );
+  hash->table.growth_left = djbhash_max_load( hash->table.capacity );
+  hash->table.count = 0;
+  for ( i = 0; i < used; i++ )
+    djbhash_table_insert( &hash->table, hash->entries[i].hash, i );
+}
+
+// Add an entry at the end of the entry array and return its index.
+static unsigned int djbhash_append_entry( struct djbhash *hash, uint64_t hash_value, struct djbhash_node *item )
+{
+  if ( hash->entries_used == hash->entries_capacity )
+  {
+    // Mostly removed entries: compact instead of growing.
+    if ( hash->count <= hash->entries_used / 2 )
+    {
+      djbhash_compact( hash );
+    } else
+    {
+      hash->entries_capacity *= 2;
+      hash->entries = realloc( hash->entries, sizeof( struct djbhash_entry ) * hash->entries_capacity );
+    }
+  }
+  hash->entries[hash->entries_used].hash = hash_value;
+  hash->entries[hash->entries_used].node = item;
+  return hash->entries_used++;
+}
+
+// Move a small hash's entries out of the inline array and index them with a slot table.
+//   `count` is the number of items to make room for.
+static void djbhash_promote( struct djbhash *hash, unsigned int count )
+{
+  unsigned int i;
+
+  hash->entries_capacity = count > DJBHASH_SMALL_MAX * 2 ? count : DJBHASH_SMALL_MAX * 2;
+  hash->entries = malloc( sizeof( struct djbhash_entry ) * hash->entries_capacity );
+  memcpy( hash->entries, hash->small, sizeof( struct djbhash_entry ) * hash->entries_used );
+  djbhash_table_alloc( &hash->table, djbhash_capacity_for( count ) );
+  for ( i = 0; i < hash->entries_used; i++ )
+    djbhash_table_insert( &hash->table, hash->entries[i].hash, i );
+}
+
+// Make sure the hash holds `count` items without growing again (rehashes right away).
+void djbhash_reserve( struct djbhash *hash, unsigned int count )
+{
+  unsigned int capacity;
+
+  if ( hash->map != NULL )
+    return;
+
+  if ( hash->table.capacity == 0 )
+  {
+    if ( count > DJBHASH_SMALL_MAX )
+      djbhash_promote( hash, count );
+    return;
+  }
+
+  djbhash_migrate( hash, UINT_MAX );
+  if ( count < hash->count )
+    count = hash->count;
+  if ( hash->entries_capacity < hash->entries_used - hash->count + count )
+  {
+    hash->entries_capacity = hash->entries_used - hash->count + count;
+    hash->entries = realloc( hash->entries, sizeof( struct djbhash_entry ) * hash->entries_capacity );
+  }
+  capacity = djbhash_capacity_for( count );
+  if ( capacity < hash->table.capacity )
+    capacity = hash->table.capacity;
+
+  // Rehash if the table is too small, or DELETED slots leave too little room.
+  if ( capacity > hash->table.capacity || hash->table.growth_left < count - hash->count )
+  {
+    djbhash_grow( hash, capacity );
+    djbhash_migrate( hash, UINT_MAX );
+  }
+}
+
+// Initialize a hash whose nodes, keys and values come from an arena.
+void djbhash_init_arena( struct djbhash *hash )
+{
+  djbhash_init( hash );
+  hash->arena = malloc( sizeof( struct djbhash_arena ) );
+  hash->arena->chunks = NULL;
+  hash->arena->free_nodes = NULL;
+  hash->arena->cleanup = NULL;
+  hash->arena->resetting = false;
+  hash->owns_arena = true;
+}
+
+// Carve `size` bytes (8 byte aligned) out of the arena, adding a chunk when the current one is full.
+static void *djbhash_arena_alloc( struct djbhash_arena *arena, size_t size )
+{
+  struct djbhash_chunk *chunk;
+  size_t chunk_size;
+  void *ptr;
+
+  size = ( size + 7 ) & ~( size_t )7;
+  chunk = arena->chunks;
+  if ( chunk == NULL || chunk->used + size > chunk->size )
+  {
+    chunk_size = size > DJBHASH_ARENA_CHUNK ? size : DJBHASH_ARENA_CHUNK;
+    chunk = malloc( sizeof( struct djbhash_chunk ) + chunk_size );
+    if ( chunk == NULL )
+      return NULL;
+    chunk->size = chunk_size;
+    chunk->used = 0;
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+  }
+  ptr = ( char * )( chunk + 1 ) + chunk->used;
+  chunk->used += size;
+  return ptr;
+}
+
+// Run the cleanup list and give back all chunks but one; every node in the arena is gone afterwards.
+static void djbhash_arena_reset( struct djbhash_arena *arena )
+{
+  struct djbhash_cleanup *cleanup;
+  struct djbhash_chunk *chunk, *next;
+
+  // Values living outside the arena (nested slot tables, DJBHASH_OTHER_MALLOCD) are released first.
+  arena->resetting = true;
+  for ( cleanup = arena->cleanup; cleanup != NULL; cleanup = cleanup->next )
+  {
+    if ( cleanup->item->value != NULL )
+      djbhash_free_value( cleanup->item );
+  }
+  arena->resetting = false;
+  arena->cleanup = NULL;
+  arena->free_nodes = NULL;
+
+  if ( arena->chunks == NULL )
+    return;
+  chunk = arena->chunks->next;
+  while ( chunk )
+  {
+    next = chunk->next;
+    free( chunk );
+    chunk = next;
+  }
+  arena->chunks->next = NULL;
+  arena->chunks->used = 0;
+}
+
+// Get memory for a key or value, from the arena if the hash has one.
+static void *djbhash_alloc( struct djbhash *hash, size_t size )
+{
+  if ( hash->arena != NULL )
+    return djbhash_arena_alloc( hash->arena, size );
+  return malloc( size );
+}
+
+// Get DJBHASH_ARRAY_ALIGN aligned memory for an array value, from the arena if the hash has one.
+static inline void *djbhash_alloc_array( struct djbhash *hash, size_t size )
+{
+  void *ptr;
+
+  if ( hash->arena != NULL )
+  {
+    ptr = djbhash_arena_alloc( hash->arena, size + DJBHASH_ARRAY_ALIGN - 8 );
+    if ( ptr == NULL )
+      return NULL;
+    return ( void * )( ( ( uintptr_t )ptr + DJBHASH_ARRAY_ALIGN - 1 ) & ~( uintptr_t )( DJBHASH_ARRAY_ALIGN - 1 ) );
+  }
+  if ( posix_memalign( &ptr, DJBHASH_ARRAY_ALIGN, size > 0 ? size : 1 ) != 0 )
+    return NULL;
+  return ptr;
+}
+
+// Get a fresh node, reusing removed arena nodes when possible. NULL if there's no memory for one.
+static struct djbhash_node *djbhash_alloc_node( struct djbhash *hash )
+{
+  struct djbhash_node *item;
+
+  if ( hash->arena == NULL )
+  {
+    item = malloc( sizeof( struct djbhash_node ) );
+    if ( item != NULL )
+      item->flags = 0;
+    return item;
+  }
+
+  item = hash->arena->free_nodes;
+  if ( item != NULL )
+  {
+    hash->arena->free_nodes = item->data.next;
+    item->flags &= DJBHASH_NODE_CLEANUP;
+  } else
+  {
+    item = djbhash_arena_alloc( hash->arena, sizeof( struct djbhash_node ) );
+    if ( item == NULL )
+      return NULL;
+    item->flags = 0;
+  }
+  item->flags |= DJBHASH_NODE_ARENA;
+  return item;
+}
+
+// Free a node taken out of the hash (arena nodes go on the free list).
+static void djbhash_release_node( struct djbhash *hash, struct djbhash_node *item )
+{
+  if ( !( item->flags & DJBHASH_NODE_ARENA ) )
+  {
+    djbhash_free_node( item );
+    return;
+  }
+  djbhash_free_value( item );
+  item->key = NULL;
+  item->data.next = hash->arena->free_nodes;
+  hash->arena->free_nodes = item;
+}
+
+// Leave a node whose value couldn't be allocated holding no value (a borrowed NULL DJBHASH_OTHER).
+static inline int djbhash_value_failed( struct djbhash_node *item )
+{
+  item->value = NULL;
+  item->data_type = DJBHASH_OTHER;
+  item->count = 0;
+  item->flags |= DJBHASH_NODE_BORROWED;
+  return false;
+}
+
+// Store a copy of the value in the node so we don't have to worry about local values and such.
+//   Scalars and short strings live inside the node; everything else gets its own memory.
+//   With DJBHASH_TAKE / DJBHASH_BORROW, strings, arrays and hashes are adopted / referenced instead (scalars are always copied).
+//   Returns false, leaving the node without a value and a taken value with the caller, if memory runs out.
+static int djbhash_value( struct djbhash *hash, struct djbhash_node *item, void *value, int data_type, int count, int ownership )
+{
+  void *temp;
+  struct djbhash *temp2;
+  struct djbhash_node *iter;
+  struct djbhash_cursor cursor;
+  struct djbhash_cleanup *cleanup;
+  int length, ok;
+
+  item->data_type = data_type;
+  item->count = count;
+  item->flags &= ~( DJBHASH_NODE_BORROWED | DJBHASH_NODE_OWNED );
+  if ( ownership == DJBHASH_BORROW && data_type >= DJBHASH_STRING )
+  {
+    // The caller keeps ownership, and the value is never freed by the hash.
+    item->value = value;
+    item->flags |= DJBHASH_NODE_BORROWED;
+    return true;
+  }
+
+  // The arena can't free what lives outside it, so it remembers nodes holding such values. The record is
+  //   allocated first, so running out of memory for it leaves nothing to undo.
+  cleanup = NULL;
+  if ( hash->arena != NULL && !( item->flags & DJBHASH_NODE_CLEANUP ) && ( data_type == DJBHASH_HASH || data_type == DJBHASH_OTHER_MALLOCD
+    || ( ownership == DJBHASH_TAKE && ( data_type == DJBHASH_STRING || djbhash_element_size( data_type ) > 0 ) ) ) )
+  {
+    cleanup = djbhash_arena_alloc( hash->arena, sizeof( struct djbhash_cleanup ) );
+    if ( cleanup == NULL )
+      return djbhash_value_failed( item );
+  }
+
+  if ( ownership == DJBHASH_TAKE && ( data_type == DJBHASH_STRING || djbhash_element_size( data_type ) > 0 ) )
+  {
+    // The caller's malloc'd buffer becomes the value.
+    item->value = value;
+    item->flags |= DJBHASH_NODE_OWNED;
+  } else if ( ownership == DJBHASH_TAKE && data_type == DJBHASH_HASH )
+  {
+    // Move the table itself and leave the source an empty hash.
+    temp2 = djbhash_alloc( hash, sizeof( struct djbhash ) );
+    if ( temp2 == NULL )
+      return djbhash_value_failed( item );
+    memcpy( temp2, value, sizeof( struct djbhash ) );
+    djbhash_init( ( struct djbhash * )value );
+    djbhash_set_hash_function( ( struct djbhash * )value, temp2->hash_function, temp2->seed );
+    ( ( struct djbhash * )value )->intern = temp2->intern;
+    temp2->iter.node = NULL;
+    item->value = temp2;
+  } else
+  {
+    switch( data_type )
+    {
+      case DJBHASH_INT:
+        item->data.i = *( int * )value;
+        item->value = &item->data;
+        break;
+      case DJBHASH_DOUBLE:
+        item->data.d = *( double * )value;
+        item->value = &item->data;
+        break;
+      case DJBHASH_CHAR:
+        item->data.c = *( unsigned char * )value;
+        item->value = &item->data;
+        break;
+      case DJBHASH_STRING:
+        length = strlen( ( char * )value );
+        if ( length < DJBHASH_INLINE_VALUE )
+          item->value = item->data.string;
+        else if ( ( item->value = djbhash_alloc( hash, sizeof( unsigned char ) * ( length + 1 ) ) ) == NULL )
+          return djbhash_value_failed( item );
+        memcpy( item->value, value, length + 1 );
+        break;
+      case DJBHASH_ARRAY:
+      case DJBHASH_INT64_ARRAY:
+      case DJBHASH_FLOAT_ARRAY:
+      case DJBHASH_DOUBLE_ARRAY:
+      case DJBHASH_BYTES:
+        // Empty arrays may come with a NULL pointer, which memcpy mustn't see even for 0 bytes.
+        temp = djbhash_alloc_array( hash, djbhash_element_size( data_type ) * count );
+        if ( temp == NULL )
+          return djbhash_value_failed( item );
+        if ( count > 0 )
+          memcpy( temp, value, djbhash_element_size( data_type ) * count );
+        item->value = temp;
+        break;
+      case DJBHASH_HASH:
+        temp2 = djbhash_alloc( hash, sizeof( struct djbhash ) );
+        if ( temp2 == NULL )
+          return djbhash_value_failed( item );
+        djbhash_init_capacity( temp2, ( ( struct djbhash * )value )->count );
+        // Nested hashes share the parent's arena and keep the source's hash function.
+        temp2->arena = hash->arena;
+        djbhash_set_hash_function( temp2, ( ( struct djbhash * )value )->hash_function, ( ( struct djbhash * )value )->seed );
+        temp2->intern = ( ( struct djbhash * )value )->intern;
+        ok = true;
+        djbhash_cursor_init( value, &cursor );
+        while ( ok && ( iter = djbhash_cursor_next( value, &cursor ) ) != NULL )
+          ok = djbhash_set_hashed( temp2, iter->key, djbhash_lookup_length( iter ), iter->hash, iter->value, iter->data_type, iter->count );
+        item->value = temp2;
+        if ( !ok )
+        {
+          djbhash_free_value( item );
+          return djbhash_value_failed( item );
+        }
+        break;
+      default:
+        item->value = value;
+    }
+  }
+
+  if ( cleanup != NULL )
+  {
+    cleanup->item = item;
+    cleanup->next = hash->arena->cleanup;
+    hash->arena->cleanup = cleanup;
+    item->flags |= DJBHASH_NODE_CLEANUP;
+  }
+  return true;
+}
+
+// Free whatever memory a node's value owns (arena memory is left for the arena).
+static void djbhash_free_value( struct djbhash_node *item )
+{
+  int in_arena;
+
+  // Borrowed values stay with the caller; adopted buffers came from malloc even in an arena.
+  if ( item->flags & DJBHASH_NODE_BORROWED )
+  {
+    item->flags &= ~DJBHASH_NODE_BORROWED;
+    item->value = NULL;
+    return;
+  }
+  in_arena = ( item->flags & DJBHASH_NODE_ARENA ) && !( item->flags & DJBHASH_NODE_OWNED );
+  item->flags &= ~DJBHASH_NODE_OWNED;
+  switch ( item->data_type )
+  {
+    case DJBHASH_STRING:
+      if ( item->value != item->data.string && !in_arena )
+        free( item->value );
+      break;
+    case DJBHASH_ARRAY:
+    case DJBHASH_INT64_ARRAY:
+    case DJBHASH_FLOAT_ARRAY:
+    case DJBHASH_DOUBLE_ARRAY:
+    case DJBHASH_BYTES:
+      if ( !in_arena )
+        free( item->value );
+      break;
+    case DJBHASH_OTHER_MALLOCD:
+      free( item->value );
+      break;
+    case DJBHASH_HASH:
+      djbhash_destroy( ( struct djbhash * )item->value );
+      if ( !in_arena )
+        free( item->value );
+      break;
+  }
+  item->value = NULL;
+}
+
+// Store a copy of the key in the node, inside it when it's short enough. False if a long key can't be allocated.
+static int djbhash_node_key( struct djbhash *hash, struct djbhash_node *item, const void *key, size_t length )
+{
+  if ( length < DJBHASH_INLINE_KEY )
+    item->key = item->key_data;
+  else if ( ( item->key = djbhash_alloc( hash, sizeof( unsigned char ) * ( length + 1 ) ) ) == NULL )
+    return false;
+  memcpy( item->key, key, length );
+  item->key[length] = '\0';
+  item->length = length;
+  return true;
+}
+
+// Initialize a hash that keeps at most `max_entries` items and `max_bytes` bytes of nodes, keys and values
+//   (0 for no limit), evicting items the CLOCK way: the least recently found ones go first.
+void djbhash_init_cache( struct djbhash *hash, unsigned int max_entries, size_t max_bytes )
+{
+  djbhash_init( hash );
+  hash->cache = calloc( 1, sizeof( struct djbhash_cache ) );
+  hash->cache->max_entries = max_entries;
+  hash->cache->max_bytes = max_bytes;
+}
+
+// Have `evict` called on each item a cache evicts.
+void djbhash_cache_on_evict( struct djbhash *hash, djbhash_evict_fn evict, void *ctx )
+{
+  hash->cache->evict = evict;
+  hash->cache->ctx = ctx;
+}
+
+// Bytes an item takes: its node, an out of line key and the value it owns (a nested hash's items included).
+size_t djbhash_node_bytes( struct djbhash_node *item )
+{
+  struct djbhash_cursor cursor;
+  struct djbhash_node *iter;
+  size_t bytes;
+
+  bytes = sizeof( struct djbhash_node );
+  if ( item->key != item->key_data && !( item->flags & DJBHASH_NODE_INTERNED ) )
+    bytes += item->length + 1;
+  if ( item->value == NULL || ( item->flags & DJBHASH_NODE_BORROWED ) )
+    return bytes;
+  switch ( item->data_type )
+  {
+    case DJBHASH_STRING:
+      if ( item->value != item->data.string )
+        bytes += strlen( ( char * )item->value ) + 1;
+      break;
+    case DJBHASH_HASH:
+      bytes += sizeof( struct djbhash );
+      djbhash_cursor_init( item->value, &cursor );
+      while ( ( iter = djbhash_cursor_next( item->value, &cursor ) ) != NULL )
+        bytes += djbhash_node_bytes( iter );
+      break;
+    default:
+      bytes += djbhash_element_size( item->data_type ) * item->count;
+  }
+  return bytes;
+}
+
+// Count an item's current size against its cache, replacing what it was charged before. Sets do this
+//   themselves; call it after filling an item's nested hash in place.
+void djbhash_cache_charge( struct djbhash *hash, struct djbhash_node *item )
+{
+  size_t bytes;
+
+  bytes = djbhash_node_bytes( item );
+  hash->cache->bytes += bytes - item->charge;
+  item->charge = bytes;
+}
+
+// Evict items until a cache is within its budget again, never `keep` (so an item larger than the whole budget
+//   stays until the next insert). The clock hand sweeps the entries in insertion order: referenced items lose
+//   their mark and are passed over once, unreferenced ones are evicted.
+static void djbhash_cache_evict( struct djbhash *hash, struct djbhash_node *keep )
+{
+  struct djbhash_cache *cache;
+  struct djbhash_node *item;
+
+  cache = hash->cache;
+  while ( hash->count > 1 && ( ( cache->max_entries > 0 && hash->count > cache->max_entries ) || ( cache->max_bytes > 0 && cache->bytes > cache->max_bytes ) ) )
+  {
+    if ( cache->hand >= hash->entries_used )
+      cache->hand = 0;
+    item = djbhash_entries( hash )[cache->hand].node;
+    if ( item == NULL || item == keep || ( item->flags & DJBHASH_NODE_REFERENCED ) )
+    {
+      if ( item != NULL && item != keep )
+        item->flags &= ~DJBHASH_NODE_REFERENCED;
+      cache->hand++;
+      continue;
+    }
+
+    // Removing leaves a hole (or shifts the next item into place in a small hash), so the hand stays put.
+    if ( cache->evict != NULL )
+      cache->evict( item, cache->ctx );
+    cache->evictions++;
+    djbhash_remove_hashed( hash, item->key, djbhash_lookup_length( item ), item->hash );
+  }
+}
+
+// Set the value for an item in the hash table.
+int djbhash_set( struct djbhash *hash, char *key, void *value, int data_type, ... )
+{
+  size_t length;
+  va_list arg_ptr;
+  int count;
+
+  // If the data type is an array, track how many elements the array has.
+  count = 0;
+  if ( djbhash_element_size( data_type ) > 0 )
+  {
+    va_start( arg_ptr, data_type );
+    count = va_arg( arg_ptr, int );
+    va_end( arg_ptr );
+  }
+
+  length = strlen( key );
+  return djbhash_set_hashed( hash, key, length, djbhash_hash_key( hash, key, length ), value, data_type, count );
+}
+
+// Set the value for a key given as a byte slice (need not be NUL terminated).
+int djbhash_set_n( struct djbhash *hash, const void *key, size_t length, void *value, int data_type, ... )
+{
+  va_list arg_ptr;
+  int count;
+
+  count = 0;
+  if ( djbhash_element_size( data_type ) > 0 )
+  {
+    va_start( arg_ptr, data_type );
+    count = va_arg( arg_ptr, int );
+    va_end( arg_ptr );
+  }
+  return djbhash_set_hashed( hash, key, length, djbhash_hash_key( hash, key, length ), value, data_type, count );
+}
+
+// Set the value for a key whose hash was already computed with djbhash_hash_key.
+int djbhash_set_hashed( struct djbhash *hash, const void *key, size_t length, uint64_t hash_value, void *value, int data_type, int count )
+{
+  return djbhash_set_ownership( hash, key, length, hash_value, value, data_type, count, DJBHASH_COPY );
+}
+
+// Set the value for a key, adopting the value without copying it.
+//   Strings and arrays must come from malloc; a hash is moved over and the caller's struct left empty.
+int djbhash_set_take( struct djbhash *hash, char *key, void *value, int data_type, ... )
+{
+  size_t length;
+  va_list arg_ptr;
+  int count;
+
+  count = 0;
+  if ( djbhash_element_size( data_type ) > 0 )
+  {
+    va_start( arg_ptr, data_type );
+    count = va_arg( arg_ptr, int );
+    va_end( arg_ptr );
+  }
+
+  length = strlen( key );
+  return djbhash_set_ownership( hash, key, length, djbhash_hash_key( hash, key, length ), value, data_type, count, DJBHASH_TAKE );
+}
+
+// Set the value for a key to memory the caller keeps owning (and must keep alive while it's in the hash).
+int djbhash_set_borrow( struct djbhash *hash, char *key, void *value, int data_type, ... )
+{
+  size_t length;
+  va_list arg_ptr;
+  int count;
+
+  count = 0;
+  if ( djbhash_element_size( data_type ) > 0 )
+  {
+    va_start( arg_ptr, data_type );
+    count = va_arg( arg_ptr, int );
+    va_end( arg_ptr );
+  }
+
+  length = strlen( key );
+  return djbhash_set_ownership( hash, key, length, djbhash_hash_key( hash, key, length ), value, data_type, count, DJBHASH_BORROW );
+}
+
+// Set the value for a pre-hashed key, copying, taking or borrowing it (DJBHASH_COPY, DJBHASH_TAKE, DJBHASH_BORROW).
+//   Returns false if memory runs out; the key is then gone, and a taken value stays with the caller.
+int djbhash_set_ownership( struct djbhash *hash, const void *key, size_t length, uint64_t hash_value, void *value, int data_type, int count, int ownership )
+{
+  struct djbhash_search search;
+
+  // Default invalid data types.
+  if ( data_type < DJBHASH_INT || data_type > DJBHASH_BYTES )
+    data_type = DJBHASH_STRING;
+  if ( djbhash_element_size( data_type ) == 0 )
+    count = 0;
+
+  // Find the item with this key, or add it, and replace its value.
+  search = djbhash_emplace( hash, key, length, hash_value );
+  if ( search.item == NULL )
+    return false;
+  djbhash_free_value( search.item );
+  if ( !djbhash_value( hash, search.item, value, data_type, count, ownership ) )
+  {
+    // Out of memory for the value: drop the key too, rather than keep it with no value.
+    djbhash_remove_hashed( hash, search.item->key, djbhash_lookup_length( search.item ), search.item->hash );
+    return false;
+  }
+
+  // Caches count the new value against their budget, and an update counts as a use.
+  if ( hash->cache != NULL )
+  {
+    djbhash_cache_charge( hash, search.item );
+    if ( search.found )
+      search.item->flags |= DJBHASH_NODE_REFERENCED;
+    djbhash_cache_evict( hash, search.item );
+  }
+  return true;
+}
+
+// Find the item for a pre-hashed key, or add one holding no value (a borrowed NULL DJBHASH_OTHER).
+//   `found` tells which happened, and `entry` is the item's traversal position. No item for mapped images.
+static struct djbhash_search djbhash_emplace( struct djbhash *hash, const void *key, size_t length, uint64_t hash_value )
+{
+  struct djbhash_search search;
+  unsigned int capacity;
+  struct djbhash_node *temp;
+  int ok;
+
+  // Mapped images are read-only.
+  if ( hash->map != NULL )
+  {
+    memset( &search, 0, sizeof( struct djbhash_search ) );
+    return search;
+  }
+
+  // Find our insert/update position.
+  search = djbhash_probe( hash, hash_value, key, length );
+
+  // If we found the item with this key, it's all we need.
+  if ( search.found )
+  {
+    djbhash_migrate( hash, DJBHASH_MIGRATE_STEP );
+    return search;
+  }
+
+  // Create our hash item, holding no value until the caller sets one. Out of memory, nothing is added.
+  temp = djbhash_alloc_node( hash );
+  if ( temp == NULL )
+    return search;
+  temp->value = NULL;
+  temp->data_type = DJBHASH_OTHER;
+  temp->count = 0;
+  temp->flags |= DJBHASH_NODE_BORROWED;
+  temp->charge = 0;
+  temp->key = temp->key_data;
+  ok = true;
+  if ( length == DJBHASH_U64_LENGTH )
+  {
+    // Number keys keep their 8 bytes inside the node; only output spells them out in decimal.
+    memcpy( temp->key_data, key, sizeof( uint64_t ) );
+    temp->key_data[sizeof( uint64_t )] = '\0';
+    temp->key = temp->key_data;
+    temp->length = sizeof( uint64_t );
+    temp->flags |= DJBHASH_NODE_U64;
+  } else if ( hash->intern != NULL && hash == &hash->intern->index )
+  {
+    // A pool's own index is handed the interned record's key, so its node points at that copy.
+    temp->key = ( char * )key;
+    temp->length = length;
+    temp->flags |= DJBHASH_NODE_INTERNED;
+  } else if ( hash->intern != NULL )
+  {
+    temp->key = ( char * )djbhash_intern_hashed( hash->intern, key, length, hash_value );
+    temp->length = length;
+    temp->flags |= DJBHASH_NODE_INTERNED;
+    ok = temp->key != NULL;
+  } else
+  {
+    ok = djbhash_node_key( hash, temp, key, length );
+  }
+  if ( !ok )
+  {
+    temp->key = temp->key_data;
+    djbhash_release_node( hash, temp );
+    return search;
+  }
+  temp->hash = hash_value;
+  search.item = temp;
+  if ( hash->cache != NULL )
+    djbhash_cache_charge( hash, temp );
+
+  // Small hashes keep their items inline until the array fills up.
+  if ( hash->table.capacity == 0 )
+  {
+    if ( hash->entries_used < DJBHASH_SMALL_MAX )
+    {
+      hash->small[hash->entries_used].hash = hash_value;
+      hash->small[hash->entries_used].node = temp;
+      search.entry = hash->entries_used++;
+      hash->count++;
+      return search;
+    }
+    djbhash_promote( hash, hash->count + 1 );
+  }
+
+  search.entry = djbhash_append_entry( hash, hash_value, temp );
+
+  // Past the load limit: start moving to a bigger table (or the same size if it's mostly DELETED slots).
+  if ( hash->table.growth_left == 0 )
+  {
+    capacity = hash->table.capacity;
+    if ( hash->count > djbhash_max_load( capacity ) / 2 )
+      capacity *= 2;
+    djbhash_grow( hash, capacity );
+  }
+
+  djbhash_table_insert( &hash->table, hash_value, search.entry );
+  hash->count++;
+  djbhash_migrate( hash, DJBHASH_MIGRATE_STEP );
+  return search;
+}
+
+// Find the item for a byte slice key, or add one holding no value (a borrowed NULL DJBHASH_OTHER) for the
+//   caller to fill in; `added` (if not NULL) tells which. NULL for mapped hashes, or if memory runs out.
+struct djbhash_node *djbhash_emplace_n( struct djbhash *hash, const void *key, size_t length, int *added )
+{
+  struct djbhash_search search;
+
+  search = djbhash_emplace( hash, key, length, djbhash_hash_key( hash, key, length ) );
+  if ( added != NULL )
+    *added = search.item != NULL && !search.found;
+  return search.item;
+}
+
+// Find an item in the hash table.
+struct djbhash_node *djbhash_find( struct djbhash *hash, char *key )
+{
+  size_t length;
+
+  length = strlen( key );
+  return djbhash_find_hashed( hash, key, length, djbhash_hash_key( hash, key, length ) );
+}
+
+// Find an item by a byte slice key.
+struct djbhash_node *djbhash_find_n( struct djbhash *hash, const void *key, size_t length )
+{
+  return djbhash_find_hashed( hash, key, length, djbhash_hash_key( hash, key, length ) );
+}
+
+// Find an item by a key whose hash was already computed with djbhash_hash_key.
+struct djbhash_node *djbhash_find_hashed( struct djbhash *hash, const void *key, size_t length, uint64_t hash_value )
+{
+  if ( hash->map != NULL )
+    return djbhash_map_find( hash, key, length, hash_value );
+  return djbhash_cache_touch( hash, djbhash_probe( hash, hash_value, key, length ).item );
+}
+
+// Start pulling in the control bytes and slots a hash will probe first.
+static inline void djbhash_prefetch_slot( struct djbhash_table *table, uint64_t mixed )
+{
+  unsigned int pos;
+
+  pos = ( unsigned int )mixed & ( table->capacity - 1 );
+  DJBHASH_PREFETCH( table->ctrl + pos );
+  DJBHASH_PREFETCH( table->slots + pos );
+}
+
+// Find a batch of keys, overlapping their cache misses.
+//   `lengths` may be NULL for NUL terminated keys; results[i] is NULL for missing keys.
+void djbhash_find_many( struct djbhash *hash, char **keys, size_t *lengths, size_t n, struct djbhash_node **results )
+{
+  size_t i, j, batch;
+  size_t length[DJBHASH_BATCH];
+  uint64_t hash_value[DJBHASH_BATCH], mixed;
+  unsigned int mask, pos, match;
+
+  for ( i = 0; i < n; i += batch )
+  {
+    batch = n - i < DJBHASH_BATCH ? n - i : DJBHASH_BATCH;
+
+    // Hash the whole batch and prefetch each key's first probe group.
+    for ( j = 0; j < batch; j++ )
+    {
+      length[j] = lengths != NULL ? lengths[i + j] : strlen( keys[i + j] );
+      hash_value[j] = djbhash_hash_key( hash, keys[i + j], length[j] );
+      if ( hash->table.capacity > 0 )
+        djbhash_prefetch_slot( &hash->table, djbhash_mix( hash_value[j] ) );
+    }
+
+    // By now the first groups are arriving: prefetch the first candidate entry of each key.
+    if ( hash->table.capacity > 0 )
+    {
+      mask = hash->table.capacity - 1;
+      for ( j = 0; j < batch; j++ )
+      {
+        mixed = djbhash_mix( hash_value[j] );
+        pos = ( unsigned int )mixed & mask;
+        match = djbhash_group_match( hash->table.ctrl + pos, ( unsigned char )( mixed >> 57 ) );
+        if ( match )
+          DJBHASH_PREFETCH( hash->entries + hash->table.slots[( pos + djbhash_ctz( match ) ) & mask] );
+      }
+    }
+
+    // Resolve the probes.
+    for ( j = 0; j < batch; j++ )
+      results[i + j] = djbhash_find_hashed( hash, keys[i + j], length[j], hash_value[j] );
+  }
+}
+
+// Set a batch of items, hashing and prefetching ahead of the inserts.
+//   `lengths` may be NULL for NUL terminated keys, `counts` may be NULL if there are no arrays.
+//   Returns false as soon as a set fails (a mapped hash, or out of memory); earlier items stay set.
+int djbhash_set_many( struct djbhash *hash, char **keys, size_t *lengths, void **values, int *data_types, int *counts, size_t n )
+{
+  size_t i, j, batch;
+  size_t length[DJBHASH_BATCH];
+  uint64_t hash_value[DJBHASH_BATCH];
+
+  for ( i = 0; i < n; i += batch )
+  {
+    batch = n - i < DJBHASH_BATCH ? n - i : DJBHASH_BATCH;
+    for ( j = 0; j < batch; j++ )
+    {
+      length[j] = lengths != NULL ? lengths[i + j] : strlen( keys[i + j] );
+      hash_value[j] = djbhash_hash_key( hash, keys[i + j], length[j] );
+      if ( hash->table.capacity > 0 )
+        djbhash_prefetch_slot( &hash->table, djbhash_mix( hash_value[j] ) );
+    }
+    for ( j = 0; j < batch; j++ )
+    {
+      if ( !djbhash_set_hashed( hash, keys[i + j], length[j], hash_value[j], values[i + j], data_types[i + j], counts != NULL ? counts[i + j] : 0 ) )
+        return false;
+    }
+  }
+  return true;
+}
+
+// Run `fn` on each of `threads` tasks of `size` bytes, one per thread, and wait for all of them.
+//   Tasks whose thread can't be started run on the calling thread.
+static void djbhash_run_threads( void *( *fn )( void * ), void *tasks, size_t size, unsigned int threads )
+{
+  pthread_t *ids;
+  char *started;
+  unsigned int t;
+
+  ids = malloc( ( sizeof( pthread_t ) + 1 ) * threads );
+  started = ( char * )( ids + threads );
+  for ( t = 1; t < threads && ids != NULL; t++ )
+    started[t] = pthread_create( &ids[t], NULL, fn, ( char * )tasks + size * t ) == 0;
+  fn( tasks );
+  for ( t = 1; t < threads; t++ )
+  {
+    if ( ids != NULL && started[t] )
+      pthread_join( ids[t], NULL );
+    else
+      fn( ( char * )tasks + size * t );
+  }
+  free( ids );
+}
+
+// Build step 1: hash a slice of the inputs, create their nodes and count them per partition.
+static void *djbhash_build_nodes( void *arg )
+{
+  struct djbhash_build_task *task;
+  struct djbhash_build *build;
+  struct djbhash_node *item;
+  size_t i, start, end, length, *counts;
+  uint64_t hash_value;
+  int data_type, count;
+
+  task = arg;
+  build = task->build;
+  start = build->n * task->thread / build->thread_count;
+  end = build->n * ( task->thread + 1 ) / build->thread_count;
+  counts = build->offsets + ( size_t )task->thread * build->part_count;
+  for ( i = start; i < end; i++ )
+  {
+    data_type = build->data_types[i];
+    if ( data_type < DJBHASH_INT || data_type > DJBHASH_BYTES )
+      data_type = DJBHASH_STRING;
+    count = djbhash_element_size( data_type ) > 0 && build->counts != NULL ? build->counts[i] : 0;
+
+    length = strlen( build->keys[i] );
+    hash_value = djbhash_hash_key( build->hash, build->keys[i], length );
+    item = djbhash_alloc_node( build->hash );
+    if ( item != NULL )
+    {
+      item->key = item->key_data;
+      item->value = NULL;
+      item->flags |= DJBHASH_NODE_BORROWED;
+    }
+    if ( item == NULL || !djbhash_node_key( build->hash, item, build->keys[i], length )
+      || !djbhash_value( build->hash, item, build->values[i], data_type, count, DJBHASH_COPY ) )
+    {
+      // Out of memory: leave the rest of the slice empty, so djbhash_build knows which nodes to free.
+      if ( item != NULL )
+      {
+        if ( item->key == NULL )
+          item->key = item->key_data;
+        djbhash_release_node( build->hash, item );
+      }
+      for ( ; i < end; i++ )
+        build->hash->entries[i].node = NULL;
+      task->failed = true;
+      return NULL;
+    }
+    item->hash = hash_value;
+
+    build->hash->entries[i].hash = hash_value;
+    build->hash->entries[i].node = item;
+    build->parts[i] = ( uint32_t )( ( ( unsigned int )djbhash_mix( hash_value ) & ( build->hash->table.capacity - 1 ) ) >> build->part_shift );
+    counts[build->parts[i]]++;
+  }
+  return NULL;
+}
+
+// Build step 2: list each thread's inputs under their partitions, keeping input order.
+static void *djbhash_build_order( void *arg )
+{
+  struct djbhash_build_task *task;
+  struct djbhash_build *build;
+  size_t i, start, end, *offsets;
+
+  task = arg;
+  build = task->build;
+  start = build->n * task->thread / build->thread_count;
+  end = build->n * ( task->thread + 1 ) / build->thread_count;
+  offsets = build->offsets + ( size_t )task->thread * build->part_count;
+  for ( i = start; i < end; i++ )
+    build->order[offsets[build->parts[i]]++] = i;
+  return NULL;
+}
+
+// A later input with the same key as entry `existing` replaces its node, keeping the earlier position.
+static inline void djbhash_build_replace( struct djbhash *hash, unsigned int existing, size_t i )
+{
+  djbhash_release_node( hash, hash->entries[existing].node );
+  hash->entries[existing].node = hash->entries[i].node;
+  hash->entries[i].node = NULL;
+}
+
+// Build step 3: insert the inputs of this thread's partitions. Nothing outside a partition's slot range is touched,
+//   so inputs whose probe would leave the range are left for a serial pass.
+static void *djbhash_build_insert( void *arg )
+{
+  struct djbhash_build_task *task;
+  struct djbhash_build *build;
+  struct djbhash_table *table;
+  struct djbhash_entry *entries;
+  struct djbhash_node *item, *other;
+  size_t i, k, end, deferred;
+  unsigned int p, slot, high;
+  uint64_t mixed;
+  unsigned char tag;
+
+  task = arg;
+  build = task->build;
+  table = &build->hash->table;
+  entries = build->hash->entries;
+  for ( p = task->thread; p < build->part_count; p += build->thread_count )
+  {
+    deferred = build->part_start[p];
+    end = build->part_start[p + 1];
+    high = ( p + 1 ) << build->part_shift;
+    for ( k = build->part_start[p]; k < end; k++ )
+    {
+      i = build->order[k];
+      item = entries[i].node;
+      mixed = djbhash_mix( entries[i].hash );
+      tag = ( unsigned char )( mixed >> 57 );
+      for ( slot = ( unsigned int )mixed & ( table->capacity - 1 ); slot < high; slot++ )
+      {
+        if ( table->ctrl[slot] == DJBHASH_CTRL_EMPTY )
+        {
+          djbhash_set_ctrl( table, slot, tag );
+          table->slots[slot] = ( unsigned int )i;
+          task->inserted++;
+          break;
+        }
+        if ( table->ctrl[slot] != tag || entries[table->slots[slot]].hash != entries[i].hash )
+          continue;
+        other = entries[table->slots[slot]].node;
+        if ( other->length == item->length && memcmp( other->key, item->key, item->length ) == 0 )
+        {
+          djbhash_build_replace( build->hash, table->slots[slot], i );
+          break;
+        }
+      }
+      if ( slot == high )
+        build->order[deferred++] = i;
+    }
+    build->deferred[p] = deferred - build->part_start[p];
+  }
+  return NULL;
+}
+
+// Free a build's bookkeeping.
+static inline void djbhash_build_free( struct djbhash_build *build, struct djbhash_build_task *tasks )
+{
+  free( build->parts );
+  free( build->order );
+  free( build->part_start );
+  free( build->deferred );
+  free( build->offsets );
+  free( tasks );
+}
+
+// Fill an empty hash from arrays of keys (NUL terminated) and values, using `threads` threads.
+//   `counts` may be NULL if there are no arrays. Later duplicates of a key win, as with djbhash_set.
+//   Arena, intern pool and cache hashes, non-empty hashes and small inputs are built with djbhash_set_many.
+//   Returns false, leaving the hash empty, if memory runs out (for any item's node, key or value included).
+int djbhash_build( struct djbhash *hash, char **keys, void **values, int *data_types, int *counts, size_t n, int threads )
+{
+  struct djbhash_build build;
+  struct djbhash_build_task *tasks;
+  struct djbhash_search search;
+  size_t i, k, offset, inserted;
+  unsigned int t, p, bits;
+
+  if ( threads <= 1 || n < DJBHASH_BUILD_MIN || n > UINT_MAX / 2 || hash->count > 0 || hash->arena != NULL || hash->intern != NULL || hash->map != NULL || hash->cache != NULL )
+    return djbhash_set_many( hash, keys, NULL, values, data_types, counts, n );
+
+  // Room for everything up front: one entry per input, and a table (without DELETED slots) that never needs to grow.
+  djbhash_empty( hash );
+  djbhash_reserve( hash, ( unsigned int )n );
+  if ( hash->entries == NULL || hash->entries_capacity < n || hash->table.capacity == 0 || hash->table.growth_left < n )
+    return false;
+
+  // Slot table partitions: a few per thread for balance, each at least a few groups wide.
+  build.hash = hash;
+  build.keys = keys;
+  build.values = values;
+  build.data_types = data_types;
+  build.counts = counts;
+  build.n = n;
+  build.thread_count = threads;
+  build.part_count = 1;
+  while ( build.part_count < build.thread_count * 4 && build.part_count * DJBHASH_GROUP_WIDTH * 4 < hash->table.capacity )
+    build.part_count *= 2;
+  for ( bits = 0; ( 1u << bits ) < build.part_count; bits++ )
+    ;
+  for ( build.part_shift = 0; ( 1u << build.part_shift ) < hash->table.capacity; build.part_shift++ )
+    ;
+  build.part_shift -= bits;
+  build.parts = malloc( sizeof( uint32_t ) * n );
+  build.order = malloc( sizeof( size_t ) * n );
+  build.part_start = malloc( sizeof( size_t ) * ( build.part_count + 1 ) );
+  build.deferred = calloc( build.part_count, sizeof( size_t ) );
+  build.offsets = calloc( ( size_t )build.thread_count * build.part_count, sizeof( size_t ) );
+  tasks = calloc( build.thread_count, sizeof( struct djbhash_build_task ) );
+  if ( build.parts == NULL || build.order == NULL || build.part_start == NULL || build.deferred == NULL || build.offsets == NULL || tasks == NULL )
+  {
+    djbhash_build_free( &build, tasks );
+    return false;
+  }
+  for ( t = 0; t < build.thread_count; t++ )
+  {
+    tasks[t].build = &build;
+    tasks[t].thread = t;
+  }
+
+  djbhash_run_threads( djbhash_build_nodes, tasks, sizeof( struct djbhash_build_task ), build.thread_count );
+
+  // If any node couldn't be made, free the ones that were and leave the hash empty.
+  for ( t = 0; t < build.thread_count && !tasks[t].failed; t++ )
+    ;
+  if ( t < build.thread_count )
+  {
+    for ( i = 0; i < n; i++ )
+    {
+      if ( hash->entries[i].node != NULL )
+        djbhash_release_node( hash, hash->entries[i].node );
+    }
+    djbhash_build_free( &build, tasks );
+    return false;
+  }
+
+  // Turn the per thread counts into write offsets: partition by partition, thread by thread.
+  offset = 0;
+  for ( p = 0; p < build.part_count; p++ )
+  {
+    build.part_start[p] = offset;
+    for ( t = 0; t < build.thread_count; t++ )
+    {
+      i = build.offsets[( size_t )t * build.part_count + p];
+      build.offsets[( size_t )t * build.part_count + p] = offset;
+      offset += i;
+    }
+  }
+  build.part_start[build.part_count] = offset;
+
+  djbhash_run_threads( djbhash_build_order, tasks, sizeof( struct djbhash_build_task ), build.thread_count );
+  djbhash_run_threads( djbhash_build_insert, tasks, sizeof( struct djbhash_build_task ), build.thread_count );
+
+  inserted = 0;
+  for ( t = 0; t < build.thread_count; t++ )
+    inserted += tasks[t].inserted;
+  hash->entries_used = ( unsigned int )n;
+  hash->table.count = ( unsigned int )inserted;
+  hash->table.growth_left -= ( unsigned int )inserted;
+
+  // Inputs that ran into the end of their partition go in one at a time.
+  for ( p = 0; p < build.part_count; p++ )
+  {
+    for ( k = build.part_start[p]; k < build.part_start[p] + build.deferred[p]; k++ )
+    {
+      i = build.order[k];
+      search = djbhash_table_probe( hash, &hash->table, hash->entries[i].hash, hash->entries[i].node->key, hash->entries[i].node->length );
+      if ( search.found )
+      {
+        djbhash_build_replace( hash, search.entry, i );
+      } else
+      {
+        djbhash_table_insert( &hash->table, hash->entries[i].hash, ( unsigned int )i );
+        inserted++;
+      }
+    }
+  }
+  hash->count = ( unsigned int )inserted;
+
+  // Drop trailing entries emptied by duplicates.
+  while ( hash->entries_used > 0 && hash->entries[hash->entries_used - 1].node == NULL )
+    hash->entries_used--;
+
+  djbhash_build_free( &build, tasks );
+  return true;
+}
+
+// Remove an item from the hash.
+int djbhash_remove( struct djbhash *hash, char *key )
+{
+  size_t length;
+
+  length = strlen( key );
+  return djbhash_remove_hashed( hash, key, length, djbhash_hash_key( hash, key, length ) );
 }
 
-// Convert a double into a string.
-unsigned char *djbhash_double_to_a( double number )
+// Remove an item by a byte slice key.
+int djbhash_remove_n( struct djbhash *hash, const void *key, size_t length )
 {
-  unsigned char *ascii;
-  ascii = calloc( 32, sizeof( unsigned char ) );
-  sprintf( ascii, "%f", number );
-  return ascii;
+  return djbhash_remove_hashed( hash, key, length, djbhash_hash_key( hash, key, length ) );
+}
+
+// Remove an item by a key whose hash was already computed with djbhash_hash_key.
+int djbhash_remove_hashed( struct djbhash *hash, const void *key, size_t length, uint64_t hash_value )
+{
+  struct djbhash_search search;
+
+  if ( hash->map != NULL )
+    return false;
+  search = djbhash_probe( hash, hash_value, key, length );
+
+  // If we don't find the item, we obviously can't remove it.
+  if ( !search.found )
+    return false;
+
+  // Small hashes close the gap; otherwise the entry is left empty until the next compaction.
+  if ( search.table == NULL )
+  {
+    memmove( hash->small + search.entry, hash->small + search.entry + 1, sizeof( struct djbhash_entry ) * ( hash->entries_used - search.entry - 1 ) );
+    hash->entries_used--;
+  } else
+  {
+    hash->entries[search.entry].node = NULL;
+    if ( search.entry == hash->entries_used - 1 )
+      hash->entries_used--;
+
+    // The table being drained is thrown away soon, so it just gets a DELETED marker.
+    if ( search.table == &hash->old )
+    {
+      djbhash_set_ctrl( &hash->old, search.slot, DJBHASH_CTRL_DELETED );
+      hash->old.count--;
+    } else
+    {
+      djbhash_table_erase( &hash->table, search.slot );
+    }
+  }
+  hash->count--;
+
+  if ( hash->cache != NULL )
+    hash->cache->bytes -= search.item->charge;
+  djbhash_release_node( hash, search.item );
+  djbhash_migrate( hash, DJBHASH_MIGRATE_STEP );
+  return true;
+}
+
+// Hash of a number key: its 8 bytes, hashed like any key with the table's hash function and seed.
+uint64_t djbhash_u64_hash( struct djbhash *hash, uint64_t key )
+{
+  return djbhash_hash_key( hash, &key, sizeof( key ) );
+}
+
+// The number a number keyed node (DJBHASH_NODE_U64) was set with.
+uint64_t djbhash_key_u64( struct djbhash_node *item )
+{
+  uint64_t key;
+
+  memcpy( &key, item->key, sizeof( key ) );
+  return key;
+}
+
+// Set the value for a number key, stored inside the node without allocating or formatting any text.
+int djbhash_set_u64( struct djbhash *hash, uint64_t key, void *value, int data_type, ... )
+{
+  va_list arg_ptr;
+  int count;
+
+  count = 0;
+  if ( djbhash_element_size( data_type ) > 0 )
+  {
+    va_start( arg_ptr, data_type );
+    count = va_arg( arg_ptr, int );
+    va_end( arg_ptr );
+  }
+  return djbhash_set_ownership( hash, &key, DJBHASH_U64_LENGTH, djbhash_u64_hash( hash, key ), value, data_type, count, DJBHASH_COPY );
+}
+
+// Find the item for a number key.
+struct djbhash_node *djbhash_find_u64( struct djbhash *hash, uint64_t key )
+{
+  if ( hash->map != NULL )
+    return djbhash_map_find( hash, &key, DJBHASH_U64_LENGTH, djbhash_u64_hash( hash, key ) );
+  return djbhash_cache_touch( hash, djbhash_probe( hash, djbhash_u64_hash( hash, key ), &key, DJBHASH_U64_LENGTH ).item );
+}
+
+// Remove the item for a number key.
+int djbhash_remove_u64( struct djbhash *hash, uint64_t key )
+{
+  return djbhash_remove_hashed( hash, &key, DJBHASH_U64_LENGTH, djbhash_u64_hash( hash, key ) );
+}
+
+// Dump all data in the hash table.
+void djbhash_dump( struct djbhash *hash )
+{
+  struct djbhash_cursor cursor;
+  struct djbhash_node *item;
+
+  djbhash_cursor_init( hash, &cursor );
+  while ( ( item = djbhash_cursor_next( hash, &cursor ) ) != NULL )
+    djbhash_print( item );
+}
+
+// Add a hash's figures (and its nested hashes') to `stats`; `top` also fills in the slot table figures.
+static void djbhash_stats_add( struct djbhash *hash, struct djbhash_stats *stats, int top )
+{
+  struct djbhash_cursor cursor;
+  struct djbhash_node *item;
+  struct djbhash_table *table;
+  struct djbhash_chunk *chunk;
+  unsigned int i, mask, distance;
+  int t;
+  size_t probes;
+
+  stats->total_count += hash->count;
+  if ( top )
+  {
+    stats->count = hash->count;
+    stats->resizing = hash->old.capacity > 0;
+    stats->entries_used = hash->entries_used;
+    stats->entries_capacity = hash->entries_capacity;
+#ifdef DJBHASH_STATS
+    stats->lookups = hash->stat_lookups;
+    stats->misses = hash->stat_misses;
+    stats->probes = hash->stat_probes;
+#endif
+
+    // Probe distance of every item: how many groups past its home group it sits.
+    probes = 0;
+    for ( t = 0; t < 2; t++ )
+    {
+      table = t == 0 ? &hash->table : &hash->old;
+      if ( table->capacity == 0 )
+        continue;
+      stats->capacity += table->capacity;
+      mask = table->capacity - 1;
+      for ( i = 0; i < table->capacity; i++ )
+      {
+        if ( table->ctrl[i] == DJBHASH_CTRL_DELETED )
+          stats->deleted_slots++;
+        if ( table->ctrl[i] & 0x80 )
+          continue;
+        stats->used_slots++;
+        distance = ( ( i - ( ( unsigned int )djbhash_mix( hash->entries[table->slots[i]].hash ) & mask ) ) & mask ) / DJBHASH_GROUP_WIDTH;
+        stats->probe_histogram[distance < DJBHASH_STATS_HISTOGRAM ? distance : DJBHASH_STATS_HISTOGRAM - 1]++;
+        if ( distance > stats->max_probe )
+          stats->max_probe = distance;
+        probes += distance + 1;
+      }
+    }
+    stats->load_factor = stats->capacity > 0 ? ( double )stats->used_slots / stats->capacity : 0;
+    stats->average_probe = stats->used_slots > 0 ? ( double )probes / stats->used_slots : 0;
+
+    if ( hash->arena != NULL && hash->owns_arena )
+    {
+      for ( chunk = hash->arena->chunks; chunk != NULL; chunk = chunk->next )
+        stats->arena_bytes += sizeof( struct djbhash_chunk ) + chunk->size;
+    }
+  }
+
+  // A mapped hash lives in its image.
+  if ( hash->map != NULL )
+  {
+    if ( top )
+      stats->table_bytes += hash->map->size;
+    return;
+  }
+
+  for ( table = &hash->table; table != NULL; table = table == &hash->table ? &hash->old : NULL )
+  {
+    if ( table->capacity > 0 )
+      stats->table_bytes += ( table->capacity + DJBHASH_GROUP_WIDTH ) * sizeof( unsigned char ) + table->capacity * sizeof( unsigned int );
+  }
+  if ( hash->entries != NULL )
+    stats->table_bytes += hash->entries_capacity * sizeof( struct djbhash_entry );
+
+  djbhash_cursor_init( hash, &cursor );
+  while ( ( item = djbhash_cursor_next( hash, &cursor ) ) != NULL )
+  {
+    stats->node_bytes += sizeof( struct djbhash_node );
+    if ( item->key != item->key_data && !( item->flags & DJBHASH_NODE_INTERNED ) )
+      stats->key_bytes += item->length + 1;
+    if ( item->flags & DJBHASH_NODE_BORROWED )
+      continue;
+    switch ( item->data_type )
+    {
+      case DJBHASH_STRING:
+        if ( item->value != item->data.string )
+          stats->value_bytes += strlen( ( char * )item->value ) + 1;
+        break;
+      case DJBHASH_ARRAY:
+      case DJBHASH_INT64_ARRAY:
+      case DJBHASH_FLOAT_ARRAY:
+      case DJBHASH_DOUBLE_ARRAY:
+      case DJBHASH_BYTES:
+        stats->value_bytes += djbhash_element_size( item->data_type ) * item->count;
+        break;
+      case DJBHASH_HASH:
+        stats->nested_hashes++;
+        stats->value_bytes += sizeof( struct djbhash );
+        djbhash_stats_add( ( struct djbhash * )item->value, stats, false );
+        break;
+    }
+  }
+}
+
+// Fill in `stats` for a hash: sizes, slot table load and probe distances, and memory use (nested hashes included).
+void djbhash_stats( struct djbhash *hash, struct djbhash_stats *stats )
+{
+  memset( stats, 0, sizeof( struct djbhash_stats ) );
+  djbhash_stats_add( hash, stats, true );
+  if ( hash->cache != NULL )
+  {
+    stats->cache_hits = hash->cache->hits;
+    stats->cache_misses = hash->cache->misses;
+    stats->cache_evictions = hash->cache->evictions;
+    stats->cache_bytes = hash->cache->bytes;
+  }
+}
+
+// Zero the lookup counters (DJBHASH_STATS builds).
+void djbhash_stats_reset( struct djbhash *hash )
+{
+#ifdef DJBHASH_STATS
+  hash->stat_lookups = 0;
+  hash->stat_misses = 0;
+  hash->stat_probes = 0;
+#endif
+  if ( hash->cache != NULL )
+  {
+    hash->cache->hits = 0;
+    hash->cache->misses = 0;
+    hash->cache->evictions = 0;
+  }
+}
+
+// Number of positions a cursor can walk over.
+unsigned int djbhash_cursor_size( struct djbhash *hash )
+{
+  if ( hash->map != NULL )
+    return hash->map->table->count;
+  return hash->entries_used;
+}
+
+// Start a traversal of the whole hash.
+void djbhash_cursor_init( struct djbhash *hash, struct djbhash_cursor *cursor )
+{
+  // Any hash starts at position 0; the parameter keeps the cursor calls alike.
+  ( void )hash;
+  cursor->pos = 0;
+  cursor->end = UINT_MAX;
+}
+
+// Start a traversal of part `part` of `parts` roughly equal slices (for splitting work between threads).
+void djbhash_cursor_range( struct djbhash *hash, struct djbhash_cursor *cursor, unsigned int part, unsigned int parts )
+{
+  uint64_t size;
+
+  size = djbhash_cursor_size( hash );
+  cursor->pos = ( unsigned int )( size * part / parts );
+  cursor->end = ( unsigned int )( size * ( part + 1 ) / parts );
+}
+
+// Move a cursor just past an item, so djbhash_cursor_next carries on with the item after it (past the end if
+//   the item isn't in the hash). The cursor's position is tried first, so stepping past the item it just
+//   returned is cheap; otherwise the item's key is looked up.
+void djbhash_cursor_seek( struct djbhash *hash, struct djbhash_cursor *cursor, struct djbhash_node *item )
+{
+  struct djbhash_search search;
+  unsigned int size, entry;
+
+  size = djbhash_cursor_size( hash );
+  if ( hash->map != NULL )
+  {
+    if ( cursor->pos > 0 && cursor->pos <= size && __atomic_load_n( &hash->map->nodes[cursor->pos - 1], __ATOMIC_ACQUIRE ) == item )
+      return;
+    entry = djbhash_map_entry( hash, item->key, djbhash_lookup_length( item ), item->hash );
+    cursor->pos = entry != UINT_MAX ? entry + 1 : size;
+    return;
+  }
+  if ( cursor->pos > 0 && cursor->pos <= size && djbhash_entries( hash )[cursor->pos - 1].node == item )
+    return;
+  search = djbhash_probe( hash, item->hash, item->key, djbhash_lookup_length( item ) );
+  cursor->pos = search.found && search.item == item ? search.entry + 1 : size;
+}
+
+// Next item of a traversal (in insertion order), or NULL at the end. Doesn't modify the hash.
+struct djbhash_node *djbhash_cursor_next( struct djbhash *hash, struct djbhash_cursor *cursor )
+{
+  struct djbhash_entry *entries;
+  struct djbhash_node *item;
+  unsigned int end;
+
+  end = djbhash_cursor_size( hash );
+  if ( cursor->end < end )
+    end = cursor->end;
+
+  // Mapped entries that don't lie inside the image are skipped.
+  if ( hash->map != NULL )
+  {
+    while ( cursor->pos < end )
+    {
+      if ( ( item = djbhash_map_node( hash, cursor->pos++ ) ) != NULL )
+        return item;
+    }
+    return NULL;
+  }
+
+  entries = djbhash_entries( hash );
+  while ( cursor->pos < end )
+  {
+    if ( entries[cursor->pos++].node != NULL )
+      return entries[cursor->pos - 1].node;
+  }
+  return NULL;
+}
+
+// Iterate through all hash items one at a time.
+struct djbhash_node *djbhash_iterate( struct djbhash *hash )
+{
+  hash->iter.node = djbhash_cursor_next( hash, &hash->iter.cursor );
+  return hash->iter.node;
+}
+
+// Reset iterator.
+void djbhash_reset_iterator( struct djbhash *hash )
+{
+  djbhash_cursor_init( hash, &hash->iter.cursor );
+  hash->iter.node = NULL;
+}
+
+// Queue a hash's items for a parallel traversal, in DJBHASH_PARALLEL_CHUNK sized ranges.
+static void djbhash_parallel_push( struct djbhash_parallel *par, struct djbhash *hash )
+{
+  struct djbhash_parallel_task *tasks;
+  unsigned int size, pos;
+  size_t needed;
+
+  size = djbhash_cursor_size( hash );
+  if ( size == 0 )
+    return;
+
+  pthread_mutex_lock( &par->lock );
+  needed = par->task_count + ( size + DJBHASH_PARALLEL_CHUNK - 1 ) / DJBHASH_PARALLEL_CHUNK;
+  if ( needed > par->task_capacity )
+  {
+    tasks = realloc( par->tasks, sizeof( struct djbhash_parallel_task ) * ( needed > par->task_capacity * 2 ? needed : par->task_capacity * 2 ) );
+    if ( tasks == NULL )
+    {
+      par->error = true;
+      pthread_mutex_unlock( &par->lock );
+      return;
+    }
+    par->tasks = tasks;
+    par->task_capacity = needed > par->task_capacity * 2 ? needed : par->task_capacity * 2;
+  }
+  // Pushed back to front so threads take the ranges in order.
+  for ( pos = ( size - 1 ) / DJBHASH_PARALLEL_CHUNK * DJBHASH_PARALLEL_CHUNK;; pos -= DJBHASH_PARALLEL_CHUNK )
+  {
+    par->tasks[par->task_count].hash = hash;
+    par->tasks[par->task_count].pos = pos;
+    par->tasks[par->task_count++].end = size - pos > DJBHASH_PARALLEL_CHUNK ? pos + DJBHASH_PARALLEL_CHUNK : size;
+    if ( pos == 0 )
+      break;
+  }
+  pthread_cond_broadcast( &par->ready );
+  pthread_mutex_unlock( &par->lock );
+}
+
+// Take ranges from the queue and visit their items until no range is left and no thread can add one.
+static void *djbhash_parallel_work( void *arg )
+{
+  struct djbhash_parallel_worker *worker;
+  struct djbhash_parallel *par;
+  struct djbhash_parallel_task task;
+  struct djbhash_cursor cursor;
+  struct djbhash_node *item;
+
+  worker = arg;
+  par = worker->shared;
+  pthread_mutex_lock( &par->lock );
+  for ( ;; )
+  {
+    while ( par->task_count == 0 && par->busy > 0 )
+      pthread_cond_wait( &par->ready, &par->lock );
+    if ( par->task_count == 0 )
+      break;
+    task = par->tasks[--par->task_count];
+    par->busy++;
+    pthread_mutex_unlock( &par->lock );
+
+    cursor.pos = task.pos;
+    cursor.end = task.end;
+    while ( ( item = djbhash_cursor_next( task.hash, &cursor ) ) != NULL )
+    {
+      if ( par->reduce != NULL )
+        par->reduce( item, worker->acc, par->ctx );
+      else
+        par->fn( item, par->ctx );
+      if ( ( par->flags & DJBHASH_PARALLEL_RECURSIVE ) && item->data_type == DJBHASH_HASH )
+        djbhash_parallel_push( par, ( struct djbhash * )item->value );
+    }
+
+    pthread_mutex_lock( &par->lock );
+    if ( --par->busy == 0 && par->task_count == 0 )
+      pthread_cond_broadcast( &par->ready );
+  }
+  pthread_mutex_unlock( &par->lock );
+  return NULL;
+}
+
+// Visit every item of a hash with `threads` threads, giving each worker's accumulator to `reduce` (or calling `fn`).
+static int djbhash_parallel_run( struct djbhash *hash, djbhash_parallel_fn fn, djbhash_reduce_fn reduce, void *ctx, struct djbhash_parallel_worker *workers, unsigned int threads, int flags )
+{
+  struct djbhash_parallel par;
+  unsigned int t;
+
+  memset( &par, 0, sizeof( struct djbhash_parallel ) );
+  pthread_mutex_init( &par.lock, NULL );
+  pthread_cond_init( &par.ready, NULL );
+  par.flags = flags;
+  par.fn = fn;
+  par.reduce = reduce;
+  par.ctx = ctx;
+  for ( t = 0; t < threads; t++ )
+    workers[t].shared = &par;
+
+  djbhash_parallel_push( &par, hash );
+  djbhash_run_threads( djbhash_parallel_work, workers, sizeof( struct djbhash_parallel_worker ), threads );
+
+  free( par.tasks );
+  pthread_cond_destroy( &par.ready );
+  pthread_mutex_destroy( &par.lock );
+  return !par.error;
+}
+
+// Call `fn` on every item using `threads` threads, which take DJBHASH_PARALLEL_CHUNK item ranges from a shared queue.
+//   With DJBHASH_PARALLEL_RECURSIVE, the items of nested hashes are queued and visited too.
+//   The hash must not be modified meanwhile. Returns false if some items couldn't be queued.
+int djbhash_parallel_for( struct djbhash *hash, djbhash_parallel_fn fn, void *ctx, int threads, int flags )
+{
+  struct djbhash_parallel_worker *workers;
+  int ok;
+
+  if ( threads < 1 )
+    threads = 1;
+  workers = calloc( threads, sizeof( struct djbhash_parallel_worker ) );
+  if ( workers == NULL )
+    return false;
+  ok = djbhash_parallel_run( hash, fn, NULL, ctx, workers, threads, flags );
+  free( workers );
+  return ok;
+}
+
+// Fold every item into per thread copies of the `size` byte accumulator `result` with `reduce`, then merge them
+//   into `result` with `combine`. `result` must start out as the identity (0 for a sum, for instance).
+int djbhash_parallel_reduce( struct djbhash *hash, djbhash_reduce_fn reduce, djbhash_combine_fn combine, void *ctx, void *result, size_t size, int threads, int flags )
+{
+  struct djbhash_parallel_worker *workers;
+  void *accs;
+  size_t stride;
+  int t, ok;
+
+  if ( threads < 1 )
+    threads = 1;
+  // Accumulators get cache lines of their own so threads updating them don't slow each other down.
+  stride = ( size + DJBHASH_CACHE_LINE - 1 ) & ~( size_t )( DJBHASH_CACHE_LINE - 1 );
+  workers = calloc( threads, sizeof( struct djbhash_parallel_worker ) );
+  if ( posix_memalign( &accs, DJBHASH_CACHE_LINE, stride * threads + 1 ) != 0 )
+    accs = NULL;
+  if ( workers == NULL || accs == NULL )
+  {
+    free( workers );
+    free( accs );
+    return false;
+  }
+  for ( t = 0; t < threads; t++ )
+  {
+    workers[t].acc = ( unsigned char * )accs + stride * t;
+    memcpy( workers[t].acc, result, size );
+  }
+
+  ok = djbhash_parallel_run( hash, NULL, reduce, ctx, workers, threads, flags );
+  for ( t = 0; t < threads; t++ )
+    combine( result, workers[t].acc, ctx );
+
+  free( workers );
+  free( accs );
+  return ok;
+}
+
+// Free memory used by a node.
+void djbhash_free_node( struct djbhash_node *item )
+{
+  if ( item->key != item->key_data && !( item->flags & DJBHASH_NODE_INTERNED ) )
+    free( item->key );
+  item->key = NULL;
+  djbhash_free_value( item );
+  free( item );
+}
+
+// Remove all elements from the hash table.
+void djbhash_empty( struct djbhash *hash )
+{
+  unsigned int i;
+  struct djbhash_entry *entries;
+
+  // Mapped images are read-only (djbhash_destroy releases them).
+  if ( hash->map != NULL )
+    return;
+
+  // An arena owner drops everything at once; a nested arena hash leaves its nodes to the owner's reset.
+  if ( hash->arena != NULL && hash->owns_arena )
+  {
+    djbhash_arena_reset( hash->arena );
+  } else if ( hash->arena == NULL || !hash->arena->resetting )
+  {
+    entries = djbhash_entries( hash );
+    for ( i = 0; i < hash->entries_used; i++ )
+    {
+      if ( entries[i].node != NULL )
+        djbhash_release_node( hash, entries[i].node );
+    }
+  }
+
+  djbhash_table_free( &hash->old );
+  hash->migrate_pos = 0;
+  if ( hash->table.capacity > 0 )
+  {
+    memset( hash->table.ctrl, DJBHASH_CTRL_EMPTY, hash->table.capacity + DJBHASH_GROUP_WIDTH );
+    hash->table.growth_left = djbhash_max_load( hash->table.capacity );
+    hash->table.count = 0;
+  }
+  hash->entries_used = 0;
+  hash->count = 0;
+  if ( hash->cache != NULL )
+  {
+    hash->cache->bytes = 0;
+    hash->cache->hand = 0;
+  }
+  djbhash_reset_iterator( hash );
+}
+
+// Remove all elements and frees memory used by the hash table.
+void djbhash_destroy( struct djbhash *hash )
+{
+  if ( hash->map != NULL )
+    djbhash_map_close( hash );
+  djbhash_empty( hash );
+  djbhash_table_free( &hash->table );
+  free( hash->entries );
+  hash->entries = NULL;
+  hash->entries_capacity = DJBHASH_SMALL_MAX;
+  if ( hash->arena != NULL && hash->owns_arena )
+  {
+    free( hash->arena->chunks );
+    free( hash->arena );
+  }
+  hash->arena = NULL;
+  free( hash->cache );
+  hash->cache = NULL;
+}
+
+// Initialize a key intern pool; tables using it hash keys with this function and seed.
+void djbhash_intern_init( struct djbhash_intern *pool, int function, uint64_t seed )
+{
+  djbhash_init_arena( &pool->index );
+  djbhash_set_hash_function( &pool->index, function, seed );
+  // The index's keys are the records' own (see djbhash_emplace).
+  pool->index.intern = pool;
+}
+
+// Header of an interned key.
+static struct djbhash_interned *djbhash_interned_record( const char *key )
+{
+  return ( struct djbhash_interned * )( key - offsetof( struct djbhash_interned, key ) );
+}
+
+// Interned copy of a key whose hash was computed with the pool's hash function (added if it's new).
+//   NULL if there's no memory to add it.
+const char *djbhash_intern_hashed( struct djbhash_intern *pool, const void *key, size_t length, uint64_t hash_value )
+{
+  struct djbhash_node *item;
+  struct djbhash_interned *record;
+
+  item = djbhash_find_hashed( &pool->index, key, length, hash_value );
+  if ( item != NULL )
+    return ( ( struct djbhash_interned * )item->value )->key;
+
+  record = djbhash_arena_alloc( pool->index.arena, sizeof( struct djbhash_interned ) + length + 1 );
+  if ( record == NULL )
+    return NULL;
+  record->hash = hash_value;
+  record->length = length;
+  memcpy( record->key, key, length );
+  record->key[length] = '\0';
+  if ( !djbhash_set_hashed( &pool->index, record->key, length, hash_value, record, DJBHASH_OTHER, 0 ) )
+    return NULL;
+  return record->key;
+}
+
+// Interned copy of a key (added if it's new). It stays valid until the pool is destroyed.
+const char *djbhash_intern( struct djbhash_intern *pool, const void *key, size_t length )
+{
+  return djbhash_intern_hashed( pool, key, length, djbhash_hash_key( &pool->index, key, length ) );
 }
 
-// Return a JSON formated array string.
-unsigned char *djbhash_json_array( int *array, int count )
+// Store this (empty) hash's keys in a shared pool; the hash takes on the pool's hash function.
+int djbhash_use_intern( struct djbhash *hash, struct djbhash_intern *pool )
 {
-  int i, j;
-  int digits, digit, value;
-  unsigned char *json;
-  unsigned char *part;
-  unsigned int length, pos, size;
-
-  json = calloc( 3, sizeof( unsigned char ) );
-  json[0] = '[';
-  pos = 1;
-  size = 1;
-  for ( i = 0; i < count; i++ )
-  {
-    part = djbhash_int_to_a( array[i] );
-    length = strlen( part );
-    size += length + 2;
-    json = realloc( json, sizeof( unsigned char ) * size );
-    for ( j = pos; j < size; j++ )
-      json[j] = '\0';
-
-    for ( j = 0; j < length; j++ )
-      json[j + pos] = part[j];
-    pos += length;
-
-    if ( i < count - 1 )
-      json[pos++] = ',';
-    free( part );
-    part = NULL;
-  }
-  json[pos] = ']';
-  return json;
+  if ( hash->count > 0 || hash->map != NULL )
+    return false;
+  hash->intern = NULL;
+  djbhash_set_hash_function( hash, pool->index.hash_function, pool->index.seed );
+  hash->intern = pool;
+  return true;
 }
 
-// Return an escaped version of a string.
-unsigned char *djbhash_escaped( unsigned char *data )
+// Find an item by a key interned in the hash's pool, without hashing it.
+struct djbhash_node *djbhash_find_interned( struct djbhash *hash, const char *key )
 {
-  unsigned char *escaped;
-  unsigned char *ptr;
-  int iter;
+  struct djbhash_interned *record;
 
-  escaped = calloc( strlen( data ) * 2 + 2, sizeof( unsigned char ) );
-  escaped[0] = '"';
-  iter = 1;
-  ptr = data;
-  while ( *ptr != '\0' )
-  {
-    switch ( *ptr )
-    {
-      case '\n':
-        escaped[iter++] = '\\';
-        escaped[iter++] = 'n';
-        break;
-      case '\t':
-        escaped[iter++] = '\\';
-        escaped[iter++] = 't';
-        break;
-      case '\r':
-        escaped[iter++] = '\\';
-        escaped[iter++] = 'r';
-        break;
-      case '\f':
-        escaped[iter++] = '\\';
-        escaped[iter++] = 'f';
-        break;
-      case '"':
-        escaped[iter++] = '\\';
-        escaped[iter++] = '"';
-        break;
-      case '\\':
-        escaped[iter++] = '\\';
-        escaped[iter++] = '\\';
-        break;
-      default:
-        escaped[iter++] = *ptr;
-        break;
-    }
-    *ptr++;
-  }
-  escaped[iter] = '"';
-  return escaped;
+  record = djbhash_interned_record( key );
+  if ( hash->intern == NULL )
+    return djbhash_find_n( hash, key, record->length );
+  return djbhash_find_hashed( hash, key, record->length, record->hash );
 }
 
-// Print an item in JSON format.
-unsigned char *djbhash_value_to_json( struct djbhash_node *item )
+// Set the value for a key interned in the hash's pool, without hashing it.
+int djbhash_set_interned( struct djbhash *hash, const char *key, void *value, int data_type, ... )
 {
-  int i;
-  int *arr_ptr;
-  unsigned char *json, *str;
-  int length;
+  struct djbhash_interned *record;
+  va_list arg_ptr;
+  int count;
 
-  switch ( item->data_type )
+  count = 0;
+  if ( djbhash_element_size( data_type ) > 0 )
   {
-    case DJBHASH_INT:
-      json = djbhash_int_to_a( *( int * )item->value );
-      break;
-    case DJBHASH_DOUBLE:
-      json = djbhash_double_to_a( *( double * )item->value );
-      break;
-    case DJBHASH_CHAR:
-      str = calloc( 2, sizeof( unsigned char ) );
-      str[0] = *( unsigned char * )item->value;
-      json = djbhash_escaped( str );
-      free( str );
-      str = NULL;
-      break;
-    case DJBHASH_STRING:
-      json = djbhash_escaped( ( unsigned char * )item->value );
-      break;
-    case DJBHASH_ARRAY:
-      json = djbhash_json_array( ( int * )item->value, item->count );
-      break;
-    case DJBHASH_HASH:
-      json = djbhash_to_json( ( struct djbhash * )item->value );
-      break;
-    default:
-      length = strlen( "UNKOWN" );
-      json = calloc( length + 1, sizeof( unsigned char ) );
-      memcpy( json, "UNKNOWN", length );
+    va_start( arg_ptr, data_type );
+    count = va_arg( arg_ptr, int );
+    va_end( arg_ptr );
   }
-  return json;
+
+  record = djbhash_interned_record( key );
+  if ( hash->intern == NULL )
+    return djbhash_set_ownership( hash, key, record->length, djbhash_hash_key( hash, key, record->length ), value, data_type, count, DJBHASH_COPY );
+  return djbhash_set_ownership( hash, key, record->length, record->hash, value, data_type, count, DJBHASH_COPY );
 }
 
-// Return a JSON formatted string containing the hash.
-unsigned char *djbhash_to_json( struct djbhash *hash )
+// Free an intern pool (after every hash using it has been destroyed).
+void djbhash_intern_destroy( struct djbhash_intern *pool )
 {
-  int i, j;
-  unsigned char *json;
-  unsigned char *key, *value;
-  unsigned int length, pos, size;
-  struct djbhash_node *iter;
-
-  json = calloc( 3, sizeof( unsigned char ) );
-  json[0] = '{';
-  pos = 1;
-  size = 1;
-  djbhash_reset_iterator( hash );
-  iter = djbhash_iterate( hash );
-  while ( iter )
-  {
-    key = djbhash_escaped( iter->key );
-    length = strlen( key );
-
-    // Reallocate memory and set it to null.
-    size += length + 3;
-    json = realloc( json, sizeof( unsigned char ) * size );
-    for ( j = pos; j < size; j++ )
-      json[j] = '\0';
-
-    // Add the key in quotes to the string.
-    for ( j = 0; j < length; j++ )
-      json[j + pos] = key[j];
-    pos += length;
-
-    // Now the value:
-    value = djbhash_value_to_json( iter );
-    length = strlen( value );
-    size += length + 1;
-    json = realloc( json, sizeof( unsigned char ) * size );
-    for ( j = pos; j < size; j++ )
-      json[j] = '\0';
-    json[pos++] = ':';
-
-    for ( j = 0; j < length; j++ )
-      json[j + pos] = value[j];
-    pos += length;
-    iter = djbhash_iterate( hash );
-    if ( iter != NULL )
-      json[pos++] = ',';
-
-    free( key );
-    key = NULL;
-    free( value );
-    value = NULL;
-  }
-  djbhash_reset_iterator( hash );
-  json[pos] = '}';
-  return json;
+  djbhash_destroy( &pool->index );
 }
 
-// Print an items' data.
-void djbhash_print_value( struct djbhash_node *item )
+// Append a block to an image being saved (`align` byte aligned, at most DJBHASH_ARRAY_ALIGN) and return its offset.
+static uint64_t djbhash_save_aligned( FILE *file, uint64_t *offset, const void *data, size_t length, uint64_t align )
 {
-  // String containing JSON formatted value.
-  unsigned char *json;
+  static const unsigned char padding[DJBHASH_ARRAY_ALIGN];
+  uint64_t start;
 
-  json = djbhash_value_to_json( item );
-  printf( "%s", json );
-  if ( json != NULL )
-  {
-    free( json );
-    json = NULL;
-  }
-  printf( "\n" );
+  start = ( *offset + align - 1 ) & ~( align - 1 );
+  fwrite( padding, 1, start - *offset, file );
+  fwrite( data, 1, length, file );
+  *offset = start + length;
+  return start;
 }
 
-// Print the key value pair.
-void djbhash_print( struct djbhash_node *item )
+// Append a block to an image being saved (8 byte aligned) and return its offset.
+static uint64_t djbhash_save_block( FILE *file, uint64_t *offset, const void *data, size_t length )
 {
-  printf( "%s => ", item->key );
-  djbhash_print_value( item );
+  return djbhash_save_aligned( file, offset, data, length, 8 );
 }
 
-// Initialize the hash table.
-void djbhash_init( struct djbhash *hash )
+// Save one table (its nested tables first) and return its offset.
+static uint64_t djbhash_save_table( FILE *file, uint64_t *offset, struct djbhash *hash )
 {
-  int i;
-  hash->buckets = malloc( sizeof( struct djbhash_bucket ) * DJBHASH_MAX_BUCKETS );
-  hash->active = malloc( sizeof( int ) * DJBHASH_MAX_BUCKETS );
-  hash->active_count = 0;
-  hash->iter.node = NULL;
-  hash->iter.last = NULL;
-  hash->iter.id = 0;
-  for ( i = 0; i < DJBHASH_MAX_BUCKETS; i++ )
+  struct djbhash_image_table table;
+  struct djbhash_image_entry *entries, *entry;
+  struct djbhash_cursor cursor;
+  struct djbhash_node *item;
+  uint32_t *index;
+  unsigned int i, mask, pos;
+  size_t size;
+
+  entries = calloc( hash->count + 1, sizeof( struct djbhash_image_entry ) );
+  i = 0;
+  djbhash_cursor_init( hash, &cursor );
+  while ( ( item = djbhash_cursor_next( hash, &cursor ) ) != NULL )
   {
-    hash->buckets[i].id = i;
-    hash->buckets[i].list = NULL;
+    entry = &entries[i++];
+    entry->hash = item->hash;
+    entry->length = item->length;
+    entry->data_type = item->data_type;
+    entry->count = item->count;
+    entry->flags = item->flags & DJBHASH_NODE_U64;
+    entry->key = djbhash_save_block( file, offset, item->key, item->length + 1 );
+    switch ( item->data_type )
+    {
+      case DJBHASH_INT:
+        size = sizeof( int );
+        break;
+      case DJBHASH_DOUBLE:
+        size = sizeof( double );
+        break;
+      case DJBHASH_CHAR:
+        size = sizeof( unsigned char );
+        break;
+      case DJBHASH_STRING:
+        size = strlen( ( char * )item->value ) + 1;
+        break;
+      case DJBHASH_ARRAY:
+      case DJBHASH_INT64_ARRAY:
+      case DJBHASH_FLOAT_ARRAY:
+      case DJBHASH_DOUBLE_ARRAY:
+      case DJBHASH_BYTES:
+        // Arrays keep their alignment in the image (relative to the mapping, which is page aligned).
+        entry->value = djbhash_save_aligned( file, offset, item->value, djbhash_element_size( item->data_type ) * item->count, DJBHASH_ARRAY_ALIGN );
+        continue;
+      case DJBHASH_HASH:
+        entry->value = djbhash_save_table( file, offset, ( struct djbhash * )item->value );
+        continue;
+      default:
+        // Pointers mean nothing in another process: OTHER values load as NULL.
+        continue;
+    }
+    entry->value = djbhash_save_block( file, offset, item->value, size );
   }
-}
 
-// DJB Hash function.
-unsigned int djb_hash( char *key, int length )
-{
-  unsigned int i;
-  unsigned int hash;
+  // Linear probing index of entry numbers (plus one, so 0 is empty), at most half full.
+  table.capacity = 1;
+  while ( table.capacity < hash->count * 2 )
+    table.capacity *= 2;
+  index = calloc( table.capacity, sizeof( uint32_t ) );
+  mask = table.capacity - 1;
+  for ( i = 0; i < hash->count; i++ )
+  {
+    pos = ( unsigned int )djbhash_mix( entries[i].hash ) & mask;
+    while ( index[pos] != 0 )
+      pos = ( pos + 1 ) & mask;
+    index[pos] = i + 1;
+  }
 
-  hash = 5381;
-  for ( i = 0; i < length; key++, i++ )
-    hash = ( ( hash << 5 ) + hash ) + ( *key );
-  return hash % DJBHASH_MAX_BUCKETS;
+  table.count = hash->count;
+  table.hash_function = hash->hash_function;
+  table.reserved = 0;
+  table.seed = hash->seed;
+  table.index = djbhash_save_block( file, offset, index, sizeof( uint32_t ) * table.capacity );
+  table.entries = djbhash_save_block( file, offset, entries, sizeof( struct djbhash_image_entry ) * hash->count );
+  free( index );
+  free( entries );
+  return djbhash_save_block( file, offset, &table, sizeof( table ) );
 }
 
-// Find the bucket for the element.
-struct djbhash_search djbhash_bin_search( struct djbhash *hash, unsigned int min, unsigned int max, unsigned int bucket_id, char *key, int length )
+// Save a hash (nested hashes and all) as an image djbhash_open_mmap can map.
+//   The image is written next to `path` and renamed over it once complete. Returns false on failure.
+int djbhash_save( struct djbhash *hash, const char *path )
 {
-  // Mid-point for search.
-  unsigned int mid;
-  // Linked list iterator and parent node.
-  struct djbhash_node *iter, *parent;
-  // Return variable.
-  struct djbhash_search pos;
+  struct djbhash_image_header header;
+  FILE *file;
+  char *temp_path;
+  uint64_t offset;
+  int ok;
 
-  // If max is less than min, we didn't find it.
-  if ( max < min )
+  temp_path = malloc( strlen( path ) + 5 );
+  sprintf( temp_path, "%s.tmp", path );
+  if ( ( file = fopen( temp_path, "wb" ) ) == NULL )
   {
-    pos.bucket_id = min;
-    pos.found = false;
-    pos.item = NULL;
-    pos.parent = NULL;
-    return pos;
+    free( temp_path );
+    return false;
   }
 
-  mid = ( min + max ) / 2;
-  if ( hash->buckets[mid].id > bucket_id )
-    return djbhash_bin_search( hash, min, mid - 1, bucket_id, key, length );
-  else if ( hash->buckets[mid].id < bucket_id )
-    return djbhash_bin_search( hash, mid + 1, max, bucket_id, key, length );
+  // The header goes in last, once the root table's offset is known.
+  memset( &header, 0, sizeof( header ) );
+  offset = 0;
+  djbhash_save_block( file, &offset, &header, sizeof( header ) );
+  header.root = djbhash_save_table( file, &offset, hash );
+  memcpy( header.magic, DJBHASH_IMAGE_MAGIC, sizeof( header.magic ) );
+  header.version = DJBHASH_IMAGE_VERSION;
+  header.byte_order = DJBHASH_IMAGE_BYTE_ORDER;
+  header.size = offset;
+  ok = fseek( file, 0, SEEK_SET ) == 0 && fwrite( &header, sizeof( header ), 1, file ) == 1;
+  ok = fflush( file ) == 0 && !ferror( file ) && ok;
+  ok = fclose( file ) == 0 && ok;
+  if ( ok )
+    ok = rename( temp_path, path ) == 0;
+  if ( !ok )
+    remove( temp_path );
+  free( temp_path );
+  return ok;
+}
 
-  // Point our iterator to the first element in this bucket.
-  iter = hash->buckets[mid].list;
-  parent = iter;
-  while ( iter )
+// Whether `length` bytes at `offset` (`align` byte aligned) lie inside a mapped image.
+static inline int djbhash_map_range( const struct djbhash_map *map, uint64_t offset, uint64_t length, uint64_t align )
+{
+  return offset % align == 0 && offset <= map->size && length <= map->size - offset;
+}
+
+// Free a node built for a mapped table, and the nested hash it attached.
+static inline void djbhash_map_free_node( struct djbhash_node *item )
+{
+  if ( item->data_type == DJBHASH_HASH )
   {
-    // We want to return if the key in the linked list actually matches.
-    if ( strncmp( iter->key, key, length ) == 0 )
-    {
-      pos.bucket_id = mid;
-      pos.found = true;
-      pos.item = iter;
-      pos.parent = parent;
-      return pos;
-    }
-    parent = iter;
-    iter = iter->next;
+    djbhash_destroy( ( struct djbhash * )item->value );
+    free( item->value );
   }
-
-  // If we got here, there the item doesn't actually exist, it's just a hash collision.
-  pos.bucket_id = mid;
-  pos.found = false;
-  pos.item = NULL;
-  pos.parent = parent;
-  return pos;
+  free( item );
 }
 
-// Create our own memory for the item value so we don't have to worry about local values and such.
-void *djbhash_value( void *value, int data_type, int count )
+// Build the node for entry `index` of a mapped table, once its key and value are known to lie inside the
+//   image. Returns NULL if they don't, or if the node can't be allocated.
+static struct djbhash_node *djbhash_map_build( struct djbhash_map *map, unsigned int index )
 {
-  int i;
-  int *temp, *iter;
-  double *temp2;
-  unsigned char *temp3;
-  void *ptr;
-  struct djbhash *temp4;
+  const struct djbhash_image_entry *entry;
   struct djbhash_node *item;
-  unsigned char *str;
-  int length;
-  void **temp5;
+  uint64_t size, align;
 
-  switch( data_type )
+  entry = ( const struct djbhash_image_entry * )( map->base + map->table->entries ) + index;
+  if ( !djbhash_map_range( map, entry->key, ( uint64_t )entry->length + 1, 1 ) || map->base[entry->key + entry->length] != '\0' )
+    return NULL;
+  switch ( entry->data_type )
   {
     case DJBHASH_INT:
-      temp = malloc( sizeof( int ) );
-      *temp = *( int * )value;
-      ptr = temp;
+      size = align = sizeof( int );
       break;
     case DJBHASH_DOUBLE:
-      temp2 = malloc( sizeof( double ) );
-      *temp2 = *( double * )value;
-      ptr = temp2;
+      size = align = sizeof( double );
       break;
     case DJBHASH_CHAR:
-      temp3 = malloc( sizeof( unsigned char ) );
-      *temp3 = *( unsigned char * )value;
-      ptr = temp3;
+      size = align = sizeof( unsigned char );
       break;
     case DJBHASH_STRING:
-      length = strlen( ( char * )value );
-      str = calloc( length + 1, sizeof( unsigned char ) );
-      memcpy( str, ( char * )value, length );
-      ptr = str;
+      if ( entry->value >= map->size || memchr( map->base + entry->value, '\0', map->size - entry->value ) == NULL )
+        return NULL;
+      size = 0;
+      align = 1;
       break;
     case DJBHASH_ARRAY:
-      temp = malloc( sizeof( int ) * count );
-      iter = value;
-      for ( i = 0; i < count; i++ )
-        temp[i] = iter[i];
-      ptr = temp;
+    case DJBHASH_INT64_ARRAY:
+    case DJBHASH_FLOAT_ARRAY:
+    case DJBHASH_DOUBLE_ARRAY:
+    case DJBHASH_BYTES:
+      if ( entry->count < 0 )
+        return NULL;
+      align = djbhash_element_size( entry->data_type );
+      size = align * ( uint64_t )entry->count;
       break;
     case DJBHASH_HASH:
-      temp4 = malloc( sizeof( struct djbhash ) );
-      djbhash_init( temp4 );
-      item = djbhash_iterate( ( struct djbhash * )value );
-      while ( item )
-      {
-        djbhash_set( temp4, item->key, item->value, item->data_type, item->count );
-        item = djbhash_iterate( ( struct djbhash * )value );
-      }
-      djbhash_reset_iterator( ( struct djbhash * )value );
-      ptr = temp4;
+      // Checked in full by djbhash_map_attach.
+      size = 0;
+      align = 1;
       break;
     default:
-      ptr = value;
+      size = 0;
+      align = 0;
+      break;
   }
-  return ptr;
+  if ( align > 0 && !djbhash_map_range( map, entry->value, size, align ) )
+    return NULL;
+
+  if ( ( item = calloc( 1, sizeof( struct djbhash_node ) ) ) == NULL )
+    return NULL;
+  item->key = ( char * )( map->base + entry->key );
+  item->hash = entry->hash;
+  item->length = entry->length;
+  item->data_type = entry->data_type;
+  item->count = entry->count;
+  item->flags = entry->flags & DJBHASH_NODE_U64;
+  if ( entry->data_type == DJBHASH_HASH )
+  {
+    item->value = malloc( sizeof( struct djbhash ) );
+    if ( item->value == NULL )
+    {
+      free( item );
+      return NULL;
+    }
+    if ( !djbhash_map_attach( ( struct djbhash * )item->value, map->base, map->size, entry->value, false ) )
+    {
+      djbhash_map_free_node( item );
+      return NULL;
+    }
+  } else if ( align > 0 )
+    item->value = ( void * )( map->base + entry->value );
+  return item;
 }
 
-// Set the value for an item in the hash table using array hash table.
-int djbhash_set( struct djbhash *hash, char *key, void *value, int data_type, ... )
+// Point a freshly initialized hash at a table of a mapped image. Only the table itself is checked here;
+//   nodes are built as lookups and traversals reach them. Returns false if the table doesn't lie inside the
+//   image or memory runs out (free the hash either way).
+static int djbhash_map_attach( struct djbhash *hash, const unsigned char *base, size_t size, uint64_t table, int owns_mapping )
 {
-  int i;
-  int chunks;
-  struct djbhash_search search;
-  unsigned int bucket_id;
-  int length;
-  va_list arg_ptr;
-  struct djbhash_node *iter, *temp;
-  int method;
-  int count;
+  const struct djbhash_image_table *image;
 
-  // Default invalid data types.
-  if ( data_type < DJBHASH_INT || data_type > DJBHASH_OTHER_MALLOCD )
-    data_type = DJBHASH_STRING;
-
-  // If the data type is an array, track how many items the array has.
-  if ( data_type == DJBHASH_ARRAY )
+  djbhash_init( hash );
+  hash->map = malloc( sizeof( struct djbhash_map ) );
+  if ( hash->map == NULL )
   {
-    va_start( arg_ptr, 1 );
-    count = va_arg( arg_ptr, int );
-    va_end( arg_ptr );
+    if ( owns_mapping )
+      munmap( ( void * )base, size );
+    return false;
   }
+  hash->map->base = base;
+  hash->map->size = size;
+  hash->map->table = NULL;
+  hash->map->nodes = NULL;
+  hash->map->owns_mapping = owns_mapping;
 
-  // Calculate the key length and bucket ID.
-  length = strlen( key );
-  bucket_id = djb_hash( key, length );
+  // The index needs an empty slot to end every probe, and both arrays must lie inside the image.
+  if ( !djbhash_map_range( hash->map, table, sizeof( struct djbhash_image_table ), 8 ) )
+    return false;
+  image = ( const struct djbhash_image_table * )( base + table );
+  if ( image->capacity == 0 || ( image->capacity & ( image->capacity - 1 ) ) != 0 || image->count >= image->capacity
+    || !djbhash_map_range( hash->map, image->index, ( uint64_t )image->capacity * sizeof( uint32_t ), sizeof( uint32_t ) )
+    || !djbhash_map_range( hash->map, image->entries, ( uint64_t )image->count * sizeof( struct djbhash_image_entry ), 8 ) )
+    return false;
+  hash->map->nodes = calloc( image->count > 0 ? image->count : 1, sizeof( struct djbhash_node * ) );
+  if ( hash->map->nodes == NULL )
+    return false;
+  hash->map->table = image;
+  hash->hash_function = image->hash_function;
+  hash->seed = image->seed;
+  hash->count = image->count;
+  return true;
+}
 
-  // Find our insert/update/append position.
-  search = djbhash_bin_search( hash, 0, DJBHASH_MAX_BUCKETS - 1, bucket_id, key, length );
+// Open an image written by djbhash_save as a read-only hash, sharing its pages with other processes.
+//   Lookups and traversals work as usual; anything that would modify the hash fails. Free with djbhash_destroy.
+int djbhash_open_mmap( struct djbhash *hash, const char *path )
+{
+  const struct djbhash_image_header *header;
+  struct stat st;
+  void *base;
+  int fd;
 
-  // If we found the item with this key, we need to just update it.
-  if ( search.found )
+  djbhash_init( hash );
+  if ( ( fd = open( path, O_RDONLY ) ) < 0 )
+    return false;
+  if ( fstat( fd, &st ) != 0 || st.st_size < ( off_t )sizeof( struct djbhash_image_header ) )
   {
-    free( search.item->value );
-    search.item->value = djbhash_value( value, data_type, count );
-    return true;
+    close( fd );
+    return false;
   }
+  base = mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+  close( fd );
+  if ( base == MAP_FAILED )
+    return false;
 
-  // Create our hash item.
-  temp = malloc( sizeof( struct djbhash_node ) );
-  temp->key = calloc( length + 1, sizeof( unsigned char ) );
-  memcpy( temp->key, key, length );
-  temp->value = djbhash_value( value, data_type, count );
-  temp->data_type = data_type;
-  temp->count = count;
-  temp->next = NULL;
-
-  if ( search.parent == NULL )
+  // Only images written by a compatible build on a machine of the same byte order can be used.
+  header = ( const struct djbhash_image_header * )base;
+  if ( memcmp( header->magic, DJBHASH_IMAGE_MAGIC, sizeof( header->magic ) ) != 0 || header->version != DJBHASH_IMAGE_VERSION
+    || header->byte_order != DJBHASH_IMAGE_BYTE_ORDER || header->size != ( uint64_t )st.st_size
+    || header->root > header->size - sizeof( struct djbhash_image_table ) )
   {
-    hash->buckets[search.bucket_id].list = temp;
-    hash->active_count++;
-    hash->active[hash->active_count - 1] = search.bucket_id;
-  } else
+    munmap( base, st.st_size );
+    return false;
+  }
+
+  if ( !djbhash_map_attach( hash, base, st.st_size, header->root, true ) )
   {
-    search.parent->next = temp;
+    djbhash_destroy( hash );
+    return false;
   }
+  return true;
 }
 
-// Find an item in the hash table using linked lists.
-struct djbhash_node *djbhash_find( struct djbhash *hash, char *key )
+// Node for entry `index` of a mapped hash, built on first use (NULL if the entry doesn't lie inside the image).
+//   Readers racing to build the same node all get whichever copy was published first.
+static struct djbhash_node *djbhash_map_node( struct djbhash *hash, unsigned int index )
 {
-  int length;
-  int bucket_id;
-  struct djbhash_search search;
-  struct djbhash_node *searcher;
+  struct djbhash_node *item, *published;
 
-  length = strlen( key );
-  bucket_id = djb_hash( key, length );
-  search = djbhash_bin_search( hash, 0, DJBHASH_MAX_BUCKETS - 1, bucket_id, key, length );
-  return search.item;
+  item = __atomic_load_n( &hash->map->nodes[index], __ATOMIC_ACQUIRE );
+  if ( item != NULL )
+    return item;
+  if ( ( item = djbhash_map_build( hash->map, index ) ) == NULL )
+    return NULL;
+  published = NULL;
+  if ( !__atomic_compare_exchange_n( &hash->map->nodes[index], &published, item, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE ) )
+  {
+    djbhash_map_free_node( item );
+    return published;
+  }
+  return item;
 }
 
-// Remove an item from the hash.
-int djbhash_remove( struct djbhash *hash, char *key )
+// Entry number of a key in a mapped hash (UINT_MAX if it isn't there), reading the image's index and entries in place.
+static unsigned int djbhash_map_entry( struct djbhash *hash, const void *key, size_t length, uint64_t hash_value )
 {
-  int i, offset;
-  int length;
-  int bucket_id;
-  struct djbhash_search search;
-  struct djbhash_node *item, *parent, *next;
+  const struct djbhash_image_table *table;
+  const struct djbhash_image_entry *entries, *entry;
+  struct djbhash_node *item;
+  const uint32_t *index;
+  unsigned int mask, pos, probes;
+  int u64;
 
-  length = strlen( key );
-  bucket_id = djb_hash( key, length );
-  search = djbhash_bin_search( hash, 0, DJBHASH_MAX_BUCKETS - 1, bucket_id, key, length );
+  // Number keys are stored as their 8 bytes, flagged so they never match text with the same bytes.
+  u64 = length == DJBHASH_U64_LENGTH;
+  if ( u64 )
+    length = sizeof( uint64_t );
+  table = hash->map->table;
+  index = ( const uint32_t * )( hash->map->base + table->index );
+  entries = ( const struct djbhash_image_entry * )( hash->map->base + table->entries );
+  mask = table->capacity - 1;
+  pos = ( unsigned int )djbhash_mix( hash_value ) & mask;
+  for ( probes = 0; probes < table->capacity && index[pos] != 0; probes++, pos = ( pos + 1 ) & mask )
+  {
+    if ( index[pos] > table->count )
+      continue;
+    entry = &entries[index[pos] - 1];
+    if ( entry->hash == hash_value && entry->length == length && ( ( entry->flags & DJBHASH_NODE_U64 ) != 0 ) == u64
+      && ( item = djbhash_map_node( hash, index[pos] - 1 ) ) != NULL && memcmp( item->key, key, length ) == 0 )
+      return index[pos] - 1;
+  }
+  return UINT_MAX;
+}
 
-  // If we don't find the item, we obviously can't remove it.
-  if ( !search.found )
-    return false;
+// Find an item in a mapped hash.
+static struct djbhash_node *djbhash_map_find( struct djbhash *hash, const void *key, size_t length, uint64_t hash_value )
+{
+  unsigned int entry;
 
-  // Otherwise, free the item, and set the parent node's next to the item's next.
-  item = search.item;
-  parent = search.parent;
-  next = search.item->next;
+  entry = djbhash_map_entry( hash, key, length, hash_value );
+  return entry != UINT_MAX ? djbhash_map_node( hash, entry ) : NULL;
+}
+
+// Release a mapped hash's nodes and nested hashes (and the mapping, for the top level hash).
+static void djbhash_map_close( struct djbhash *hash )
+{
+  struct djbhash_map *map;
+  unsigned int i;
 
-  if ( parent == item )
+  map = hash->map;
+  if ( map->nodes != NULL && map->table != NULL )
   {
-    hash->buckets[search.bucket_id].list = next;
-    if ( hash->buckets[search.bucket_id].list == NULL )
+    for ( i = 0; i < map->table->count; i++ )
     {
-      offset = 0;
-      // Remove this from active buckets.
-      for ( i = 0; i < hash->active_count; i++ )
-      {
-        if ( hash->active[i] == search.bucket_id )
-          offset = 1;
-        else
-          hash->active[i - offset] = hash->active[i];
-      }
-      hash->active_count--;
+      if ( map->nodes[i] != NULL )
+        djbhash_map_free_node( map->nodes[i] );
     }
-  } else
-  {
-    parent->next = next;
   }
-
-  djbhash_free_node( search.item );
-  return true;
+  free( map->nodes );
+  if ( map->owns_mapping )
+    munmap( ( void * )map->base, map->size );
+  free( map );
+  hash->map = NULL;
+  hash->count = 0;
 }
 
-// Dump all data in the hash table using linked lists.
-void djbhash_dump( struct djbhash *hash )
+// Initialize a concurrent hash split into `shards` independently locked tables (rounded up to a power of two).
+void djbhash_concurrent_init( struct djbhash_concurrent *hash, unsigned int shards )
 {
-  int i;
-  struct djbhash_node *iter;
+  unsigned int i;
 
-  for ( i = 0; i < hash->active_count; i++ )
+  hash->shard_count = 1;
+  while ( hash->shard_count < shards )
+    hash->shard_count *= 2;
+  hash->shards = malloc( sizeof( struct djbhash_shard ) * hash->shard_count );
+  for ( i = 0; i < hash->shard_count; i++ )
   {
-    iter = hash->buckets[hash->active[i]].list;
-    while ( iter )
-    {
-      djbhash_print( iter );
-      iter = iter->next;
-    }
+    pthread_rwlock_init( &hash->shards[i].lock, NULL );
+    djbhash_init( &hash->shards[i].hash );
   }
 }
 
-// Iterate through all hash items one at a time.
-struct djbhash_node *djbhash_iterate( struct djbhash *hash )
+// Pick the hash function for every shard (only while empty).
+int djbhash_concurrent_set_hash_function( struct djbhash_concurrent *hash, int function, uint64_t seed )
 {
-  if ( hash->iter.node == NULL && hash->iter.last == NULL )
-  {
-    if ( hash->active_count > 0 )
-    {
-      hash->iter.node = hash->buckets[hash->active[0]].list;
-      return hash->iter.node;
-    }
-    return NULL;
-  } else if ( hash->iter.node == NULL )
-    return NULL;
+  unsigned int i;
+  int ok;
 
-  hash->iter.last = hash->iter.node;
-  hash->iter.node = hash->iter.node->next;
-  if ( hash->iter.node == NULL )
+  ok = true;
+  for ( i = 0; i < hash->shard_count; i++ )
   {
-    if ( hash->iter.id == hash->active_count - 1 )
-      return NULL;
-    hash->iter.id++;
-    hash->iter.node = hash->buckets[hash->active[hash->iter.id]].list;
+    pthread_rwlock_wrlock( &hash->shards[i].lock );
+    ok = djbhash_set_hash_function( &hash->shards[i].hash, function, seed ) && ok;
+    pthread_rwlock_unlock( &hash->shards[i].lock );
   }
-  return hash->iter.node;
+  return ok;
 }
 
-// Reset iterator.
-void djbhash_reset_iterator( struct djbhash *hash )
+// Shard a hash value belongs to (bits the slot tables themselves don't use much).
+static inline struct djbhash_shard *djbhash_concurrent_shard( struct djbhash_concurrent *hash, uint64_t hash_value )
 {
-  hash->iter.id = 0;
-  hash->iter.node = NULL;
-  hash->iter.last = NULL;
+  return &hash->shards[( unsigned int )( djbhash_mix( hash_value ) >> 40 ) & ( hash->shard_count - 1 )];
 }
 
-// Free memory used by a node.
-void djbhash_free_node( struct djbhash_node *item )
+// Set the value for an item; only its shard is locked.
+int djbhash_concurrent_set( struct djbhash_concurrent *hash, char *key, void *value, int data_type, ... )
 {
-  if ( item->key != NULL )
-  {
-    free( item->key );
-    item->key = NULL;
-  }
-  if ( item->value != NULL && item->data_type != DJBHASH_OTHER && item->data_type != DJBHASH_HASH )
-  {
-    free( item->value );
-    item->value = NULL;
-  } else if ( item->data_type == DJBHASH_HASH )
+  struct djbhash_shard *shard;
+  uint64_t hash_value;
+  size_t length;
+  va_list arg_ptr;
+  int count, ret;
+
+  count = 0;
+  if ( djbhash_element_size( data_type ) > 0 )
   {
-    djbhash_destroy( ( struct djbhash * )item->value );
-    free( item->value );
-    item->value = NULL;
+    va_start( arg_ptr, data_type );
+    count = va_arg( arg_ptr, int );
+    va_end( arg_ptr );
   }
-  free( item );
-  item = NULL;
+
+  // Every shard uses the same hash function, so hashing happens outside the lock.
+  length = strlen( key );
+  hash_value = djbhash_hash_key( &hash->shards[0].hash, key, length );
+  shard = djbhash_concurrent_shard( hash, hash_value );
+  pthread_rwlock_wrlock( &shard->lock );
+  ret = djbhash_set_hashed( &shard->hash, key, length, hash_value, value, data_type, count );
+  pthread_rwlock_unlock( &shard->lock );
+  return ret;
 }
 
-// Remove all elements from the hash table.
-void djbhash_empty( struct djbhash *hash )
+// Look up an item and call `fn` on it while its shard is read locked.
+//   The node must not be used after `fn` returns. Returns whether the item was found.
+int djbhash_concurrent_find( struct djbhash_concurrent *hash, char *key, djbhash_concurrent_fn fn, void *ctx )
 {
-  int i;
-  struct djbhash_node *iter;
-  struct djbhash_node *next;
-  for ( i = 0; i < DJBHASH_MAX_BUCKETS; i++ )
+  struct djbhash_shard *shard;
+  struct djbhash_node *item;
+  uint64_t hash_value;
+  size_t length;
+
+  length = strlen( key );
+  hash_value = djbhash_hash_key( &hash->shards[0].hash, key, length );
+  shard = djbhash_concurrent_shard( hash, hash_value );
+  pthread_rwlock_rdlock( &shard->lock );
+  item = djbhash_find_hashed( &shard->hash, key, length, hash_value );
+  if ( item != NULL && fn != NULL )
+    fn( item, ctx );
+  pthread_rwlock_unlock( &shard->lock );
+  return item != NULL;
+}
+
+// Remove an item; only its shard is locked.
+int djbhash_concurrent_remove( struct djbhash_concurrent *hash, char *key )
+{
+  struct djbhash_shard *shard;
+  uint64_t hash_value;
+  size_t length;
+  int ret;
+
+  length = strlen( key );
+  hash_value = djbhash_hash_key( &hash->shards[0].hash, key, length );
+  shard = djbhash_concurrent_shard( hash, hash_value );
+  pthread_rwlock_wrlock( &shard->lock );
+  ret = djbhash_remove_hashed( &shard->hash, key, length, hash_value );
+  pthread_rwlock_unlock( &shard->lock );
+  return ret;
+}
+
+// Number of items across all shards.
+unsigned int djbhash_concurrent_count( struct djbhash_concurrent *hash )
+{
+  unsigned int i, count;
+
+  count = 0;
+  for ( i = 0; i < hash->shard_count; i++ )
   {
-    iter = hash->buckets[i].list;
-    while ( iter )
-    {
-      next = iter->next;
-      djbhash_free_node( iter );
-      iter = next;
-    }
+    pthread_rwlock_rdlock( &hash->shards[i].lock );
+    count += hash->shards[i].hash.count;
+    pthread_rwlock_unlock( &hash->shards[i].lock );
   }
-  hash->active_count = 0;
+  return count;
 }
 
-// Remove all elements and frees memory used by the hash table.
-void djbhash_destroy( struct djbhash *hash )
+// Free every shard (no other thread may be using the hash).
+void djbhash_concurrent_destroy( struct djbhash_concurrent *hash )
 {
-  djbhash_empty( hash );
-  free( hash->buckets );
-  hash->buckets = NULL;
-  free( hash->active );
-  hash->active = NULL;
+  unsigned int i;
+
+  for ( i = 0; i < hash->shard_count; i++ )
+  {
+    djbhash_destroy( &hash->shards[i].hash );
+    pthread_rwlock_destroy( &hash->shards[i].lock );
+  }
+  free( hash->shards );
+  hash->shards = NULL;
+  hash->shard_count = 0;
 }
@@ -1,71 +1,514 @@
+#ifndef DJBHASH_H
+#define DJBHASH_H
+
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+// C++ has its own true and false (see djbhash.hpp for the C++ wrapper).
+#ifndef __cplusplus
+  #ifndef true
+    #define true 1
+  #endif
+  #ifndef false
+    #define false 0
+  #endif
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
-#ifndef true
-  #define true 1
+// Hash functions a table can use.
+enum djbhash_hash_function {
+  // Classic DJB hash, one byte per step (the default).
+  DJBHASH_FUNCTION_DJB2,
+  // Seeded wyhash-style hash, 16-48 bytes per step; use a random seed against hash flooding.
+  DJBHASH_FUNCTION_WY,
+};
+
+// Hash function and seed new tables start with; override at compile time with -D.
+#ifndef DJBHASH_DEFAULT_FUNCTION
+  #define DJBHASH_DEFAULT_FUNCTION DJBHASH_FUNCTION_DJB2
 #endif
-#ifndef false
-  #define false 0
+#ifndef DJBHASH_DEFAULT_SEED
+  #define DJBHASH_DEFAULT_SEED 0
 #endif
 
-#define DJBHASH_MAX_BUCKETS 65536
+// Number of control bytes examined per probe step.
+#define DJBHASH_GROUP_WIDTH 16
+// Smallest slot table we allocate (must be at least one group wide).
+#define DJBHASH_MIN_CAPACITY 16
+// Keys hashed and prefetched together by djbhash_find_many / djbhash_set_many.
+#define DJBHASH_BATCH 16
+// Hashes with at most this many items keep them in an inline array instead of a slot table.
+#define DJBHASH_SMALL_MAX 8
+// Bytes a streaming JSON writer collects before handing them to its callback.
+#define DJBHASH_JSON_BUFFER 65536
+// Snapshot image identification (see djbhash_save).
+#define DJBHASH_IMAGE_MAGIC "DJBHASH"
+#define DJBHASH_IMAGE_VERSION 2
+#define DJBHASH_IMAGE_BYTE_ORDER 0x01020304
+// Inputs below which djbhash_build just inserts them one by one.
+#define DJBHASH_BUILD_MIN 16384
+// Alignment of array values copied into a hash.
+#define DJBHASH_ARRAY_ALIGN 64
+// Array elements a JSON writer formats per buffer reservation.
+#define DJBHASH_JSON_BLOCK 64
+// Cache line size: djbhash_parallel_reduce gives each thread's accumulator lines of its own.
+#define DJBHASH_CACHE_LINE 64
+// Items per task of djbhash_parallel_for and djbhash_parallel_reduce.
+#define DJBHASH_PARALLEL_CHUNK 4096
+// djbhash_parallel_* flag: also visit the items of nested hashes, as tasks of their own.
+#define DJBHASH_PARALLEL_RECURSIVE 0x01
+// Probe distances djbhash_stats tells apart.
+#define DJBHASH_STATS_HISTOGRAM 16
+// Deepest nesting of objects and arrays djbhash_from_json accepts.
+#define DJBHASH_JSON_MAX_DEPTH 512
+// Slots moved from the old table to the new one on each write while resizing.
+#define DJBHASH_MIGRATE_STEP 64
+// Control byte values for slots that don't hold an item.
+#define DJBHASH_CTRL_EMPTY 0x80
+#define DJBHASH_CTRL_DELETED 0xFE
+
+// Longest string value (including the terminator) stored inside the node.
+#define DJBHASH_INLINE_VALUE 16
+// Longest key (including the terminator) stored inside the node.
+#define DJBHASH_INLINE_KEY 24
+
+// Size of each arena chunk (bigger allocations get a chunk of their own).
+#define DJBHASH_ARENA_CHUNK 65536
+
+// Node flags.
+//   ARENA: the node, its key and its value were allocated from an arena.
+//   CLEANUP: the node is on its arena's cleanup list.
+//   BORROWED: the value belongs to the caller and is never freed.
+//   OWNED: the value is a malloc'd buffer adopted from the caller (freed with free even in an arena).
+//   INTERNED: the key belongs to the hash's intern pool.
+#define DJBHASH_NODE_ARENA 0x01
+#define DJBHASH_NODE_CLEANUP 0x02
+#define DJBHASH_NODE_BORROWED 0x04
+#define DJBHASH_NODE_OWNED 0x08
+#define DJBHASH_NODE_INTERNED 0x10
+// Node keyed by a number (djbhash_set_u64); its key is the number's 8 bytes (see djbhash_key_u64).
+#define DJBHASH_NODE_U64 0x20
+// Node found since the cache's clock hand last passed it (cache mode only).
+#define DJBHASH_NODE_REFERENCED 0x40
+
+// Inline storage for scalar and short string values, tagged by the node's data type.
+union djbhash_inline {
+  int i;
+  double d;
+  unsigned char c;
+  char string[DJBHASH_INLINE_VALUE];
+  // Next free node, while the node sits on an arena's free list.
+  struct djbhash_node *next;
+};
 
 // Node structure
 struct djbhash_node {
-  // Key string.
+  // Key string (points at key_data for short keys).
   char *key;
-  // Generic pointer to value.
+  // Generic pointer to value (points at data for scalars and short strings).
   void *value;
+  // Full hash of the key, kept so lookups and resizes never hash it again.
+  uint64_t hash;
+  // Key length.
+  unsigned int length;
   // Data type for this node.
   int data_type;
   // If it's an array data type, the number of items.
   int count;
-  // Pointer to the next node in the list.
-  struct djbhash_node *next;
+  // DJBHASH_NODE_* flags.
+  int flags;
+  // Bytes a cache counts for this item, as of its last set (see djbhash_cache_charge).
+  size_t charge;
+  // Inline value storage.
+  union djbhash_inline data;
+  // Inline key storage.
+  char key_data[DJBHASH_INLINE_KEY];
 };
 
-// Iterator object.
+// Position of one traversal; any number of them can walk a hash at once.
+struct djbhash_cursor {
+  // Next position to examine.
+  unsigned int pos;
+  // One past the last position (UINT_MAX for the whole hash).
+  unsigned int end;
+};
+
+// Iterator object used by djbhash_iterate.
 struct djbhash_iterator {
-  // Active ID.
-  int id;
-  // Node pointer.
+  // Position of the built-in traversal.
+  struct djbhash_cursor cursor;
+  // Last node returned.
   struct djbhash_node *node;
-  // Last pointer.
-  struct djbhash_node *last;
 };
 
-// Linked list bucket structure.
-struct djbhash_bucket {
-  // Bucket ID.
-  unsigned int id;
-  // Linked list containing items.
-  struct djbhash_node *list;
+// Slot table for open addressing.
+struct djbhash_table {
+  // Control bytes, one per slot plus a mirrored group at the end.
+  //   Full slots hold the top 7 bits of the mixed hash, free slots hold EMPTY or DELETED.
+  unsigned char *ctrl;
+  // Entry indexes, parallel to the control bytes.
+  unsigned int *slots;
+  // Number of slots (always a power of two).
+  unsigned int capacity;
+  // Number of EMPTY slots we may still fill before growing.
+  unsigned int growth_left;
+  // Number of items in this table.
+  unsigned int count;
+};
+
+// Item slot of the insertion ordered entry array.
+struct djbhash_entry {
+  // Key hash (copied from the node so probes needn't touch it).
+  uint64_t hash;
+  // The item, or NULL once removed.
+  struct djbhash_node *node;
+};
+
+// Arena chunk; the memory handed out follows the header.
+struct djbhash_chunk {
+  // Next (older) chunk.
+  struct djbhash_chunk *next;
+  // Usable bytes in this chunk.
+  size_t size;
+  // Bytes handed out so far.
+  size_t used;
+};
+
+// Node whose value holds memory outside the arena (nested slot tables, DJBHASH_OTHER_MALLOCD).
+struct djbhash_cleanup {
+  struct djbhash_cleanup *next;
+  struct djbhash_node *item;
+};
+
+// Slab allocator for nodes, keys and values.
+struct djbhash_arena {
+  // Chunks, newest first.
+  struct djbhash_chunk *chunks;
+  // Removed nodes waiting to be reused.
+  struct djbhash_node *free_nodes;
+  // Nodes to clean up on reset.
+  struct djbhash_cleanup *cleanup;
+  // Set while a reset runs the cleanup list.
+  int resetting;
+};
+
+// Start of a saved image. Offsets in an image are from its start, so it can be mapped anywhere.
+struct djbhash_image_header {
+  // DJBHASH_IMAGE_MAGIC, version, and DJBHASH_IMAGE_BYTE_ORDER as stored by the saving machine.
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  // Size of the whole image.
+  uint64_t size;
+  // Offset of the top level table.
+  uint64_t root;
+};
+
+// Table of a saved image.
+struct djbhash_image_table {
+  // Number of items, and slots in the index (a power of two).
+  uint32_t count;
+  uint32_t capacity;
+  // Hash function and seed the item hashes were made with.
+  int32_t hash_function;
+  uint32_t reserved;
+  uint64_t seed;
+  // Offset of the linear probing index: uint32_t entry number plus one per slot, 0 if empty.
+  uint64_t index;
+  // Offset of the entries, in insertion order.
+  uint64_t entries;
+};
+
+// Item of a saved table.
+struct djbhash_image_entry {
+  uint64_t hash;
+  // Offset of the NUL terminated key.
+  uint64_t key;
+  // Offset of the value (of the table for DJBHASH_HASH; 0 if there is none).
+  uint64_t value;
+  uint32_t length;
+  int32_t data_type;
+  int32_t count;
+  // Node flags that describe the key (DJBHASH_NODE_U64).
+  uint32_t flags;
+};
+
+// Read-only hash backed by a mapped image.
+struct djbhash_map {
+  // Mapping, shared by the top level hash and its nested hashes.
+  const unsigned char *base;
+  size_t size;
+  // This hash's table in the image.
+  const struct djbhash_image_table *table;
+  // Nodes handed out, one per entry: NULL until a lookup or traversal first reaches the entry.
+  struct djbhash_node **nodes;
+  // Whether destroying this hash unmaps the image.
+  int owns_mapping;
+};
+
+// Callback told about an item a cache is evicting, just before it's freed.
+typedef void ( *djbhash_evict_fn )( struct djbhash_node *item, void *ctx );
+
+// Budget and CLOCK eviction state of a hash in cache mode (see djbhash_init_cache).
+struct djbhash_cache {
+  // Most items and bytes kept (0 for no limit).
+  unsigned int max_entries;
+  size_t max_bytes;
+  // Bytes the items take now: nodes, out of line keys and owned values (nested hashes' items included).
+  size_t bytes;
+  // Clock hand: next entry to consider for eviction.
+  unsigned int hand;
+  // Finds that found / missed their key, and items evicted.
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+  // Eviction callback (NULL for none) and its context.
+  djbhash_evict_fn evict;
+  void *ctx;
 };
 
-// Linked list structure.
+// Open addressing hash table.
 struct djbhash {
-  // Buckets.
-  struct djbhash_bucket *buckets;
-  // List of active buckets.
-  int *active;
-  // Number of active buckets.
-  int active_count;
+  // Items of a small hash, scanned linearly (used while table.capacity is 0).
+  struct djbhash_entry small[DJBHASH_SMALL_MAX];
+  // Items in insertion order, indexed by the slot tables (NULL while small).
+  struct djbhash_entry *entries;
+  // Entries filled so far (removed ones included) and room for them.
+  unsigned int entries_used;
+  unsigned int entries_capacity;
+  // Table new items go into.
+  struct djbhash_table table;
+  // Previous table while a resize is in progress (capacity 0 otherwise).
+  struct djbhash_table old;
+  // Next slot of the old table to move over.
+  unsigned int migrate_pos;
+  // Number of items in the hash.
+  unsigned int count;
+  // Mapped image this read-only hash serves from (NULL for normal hashes).
+  struct djbhash_map *map;
+  // Pool keys are interned in (NULL if each node keeps its own copy).
+  struct djbhash_intern *intern;
+  // Arena nodes come from (NULL for plain malloc).
+  struct djbhash_arena *arena;
+  // Budget this hash is kept within (NULL unless it's a cache).
+  struct djbhash_cache *cache;
+  // Whether this hash created the arena (nested hashes share their parent's).
+  int owns_arena;
+  // DJBHASH_FUNCTION_* used for keys, and its seed.
+  int hash_function;
+  uint64_t seed;
   // Iterator to get through all elements.
   struct djbhash_iterator iter;
+#ifdef DJBHASH_STATS
+  // Lookups (finds, and the searches done by sets and removes), the ones that missed, and groups probed.
+  uint64_t stat_lookups;
+  uint64_t stat_misses;
+  uint64_t stat_probes;
+#endif
+};
+
+// Figures reported by djbhash_stats.
+struct djbhash_stats {
+  // Items in the hash, and in it plus all nested hashes.
+  size_t count;
+  size_t total_count;
+  // Slots (both tables while resizing), full and DELETED ones, and full / all.
+  size_t capacity;
+  size_t used_slots;
+  size_t deleted_slots;
+  double load_factor;
+  int resizing;
+  // Dense entries filled (removed ones included) and allocated.
+  size_t entries_used;
+  size_t entries_capacity;
+  // Items by probe distance in groups from their home group (the last bucket holds the rest), longest distance,
+  //   and average groups a successful lookup probes.
+  size_t probe_histogram[DJBHASH_STATS_HISTOGRAM];
+  size_t max_probe;
+  double average_probe;
+  // Bytes used, nested hashes included: nodes, out of line keys and values, slot tables and entry arrays.
+  size_t node_bytes;
+  size_t key_bytes;
+  size_t value_bytes;
+  size_t table_bytes;
+  // Bytes held by the hash's own arena (nodes, keys and values above come out of it).
+  size_t arena_bytes;
+  size_t nested_hashes;
+  // Lookup counters (DJBHASH_STATS builds only; 0 otherwise).
+  uint64_t lookups;
+  uint64_t misses;
+  uint64_t probes;
+  // Cache mode counters and budget use (0 for other hashes).
+  uint64_t cache_hits;
+  uint64_t cache_misses;
+  uint64_t cache_evictions;
+  size_t cache_bytes;
+};
+
+// Key stored in an intern pool, with its hash and length in front of it.
+struct djbhash_interned {
+  uint64_t hash;
+  unsigned int length;
+#ifdef __cplusplus
+  // ISO C++ has no flexible array members; this has the same offset and size.
+  char key[1];
+#else
+  char key[];
+#endif
+};
+
+// Pool of interned keys shared by many hashes (not thread safe).
+struct djbhash_intern {
+  // Records by key; its arena holds the records, and its nodes' keys point into them.
+  struct djbhash index;
+};
+
+// One independently locked table of a concurrent hash.
+struct djbhash_shard {
+  pthread_rwlock_t lock;
+  struct djbhash hash;
+};
+
+// Hash split into shards so threads working on different keys rarely contend.
+struct djbhash_concurrent {
+  // Shards (a power of two of them).
+  struct djbhash_shard *shards;
+  unsigned int shard_count;
+};
+
+// Callback run on an item while its shard is locked.
+typedef void ( *djbhash_concurrent_fn )( struct djbhash_node *item, void *ctx );
+
+// Callback run on each item by djbhash_parallel_for (possibly on several threads at once).
+typedef void ( *djbhash_parallel_fn )( struct djbhash_node *item, void *ctx );
+
+// Callback folding an item into the calling thread's accumulator for djbhash_parallel_reduce.
+typedef void ( *djbhash_reduce_fn )( struct djbhash_node *item, void *acc, void *ctx );
+
+// Callback merging accumulator `other` into `acc`.
+typedef void ( *djbhash_combine_fn )( void *acc, const void *other, void *ctx );
+
+// A range of one hash's items waiting to be visited.
+struct djbhash_parallel_task {
+  struct djbhash *hash;
+  unsigned int pos;
+  unsigned int end;
+};
+
+// Shared state of djbhash_parallel_for and djbhash_parallel_reduce.
+struct djbhash_parallel {
+  pthread_mutex_t lock;
+  // Signalled when tasks are added or the last busy thread finishes.
+  pthread_cond_t ready;
+  // Ranges no thread has taken yet.
+  struct djbhash_parallel_task *tasks;
+  size_t task_count;
+  size_t task_capacity;
+  // Threads working on a range (and so possibly adding more).
+  unsigned int busy;
+  int flags;
+  // Set when tasks couldn't be queued.
+  int error;
+  // Callback (one of the two) and its context.
+  djbhash_parallel_fn fn;
+  djbhash_reduce_fn reduce;
+  void *ctx;
+};
+
+// One thread of a parallel traversal.
+struct djbhash_parallel_worker {
+  struct djbhash_parallel *shared;
+  // This thread's accumulator (djbhash_parallel_reduce only).
+  void *acc;
+};
+
+// Callback receiving a streaming JSON writer's output; returns false on failure.
+typedef int ( *djbhash_json_write_fn )( void *ctx, const void *data, size_t length );
+
+// JSON output, collected in one growing buffer or streamed through a callback.
+struct djbhash_json_writer {
+  // Output (or not yet flushed output when streaming).
+  unsigned char *data;
+  size_t length;
+  size_t capacity;
+  // Callback for streaming output (NULL to keep everything in data).
+  djbhash_json_write_fn write;
+  void *ctx;
+  // Set once a callback has failed.
+  int error;
+};
+
+// State of djbhash_from_json.
+struct djbhash_json_parser {
+  // Input left to parse.
+  const unsigned char *pos;
+  const unsigned char *end;
+  // Decoded strings.
+  char *scratch;
+  size_t scratch_size;
+  // Numbers of the array being parsed (as doubles once one isn't an int).
+  int *ints;
+  size_t ints_size;
+  double *doubles;
+  size_t doubles_size;
+  // Current object / array nesting.
+  int depth;
+};
+
+// Shared state of a parallel djbhash_build.
+struct djbhash_build {
+  struct djbhash *hash;
+  char **keys;
+  void **values;
+  int *data_types;
+  int *counts;
+  size_t n;
+  // Slot table partition of each input, inputs ordered by partition, and where each partition's inputs start.
+  uint32_t *parts;
+  size_t *order;
+  size_t *part_start;
+  // Inputs per thread and partition (then each thread's write offsets).
+  size_t *offsets;
+  // Inputs of each partition left for the serial pass.
+  size_t *deferred;
+  unsigned int part_count;
+  // Slot index bits below the partition number.
+  unsigned int part_shift;
+  unsigned int thread_count;
+};
+
+// One thread's part of a djbhash_build.
+struct djbhash_build_task {
+  struct djbhash_build *build;
+  unsigned int thread;
+  // Items it put in the slot table.
+  size_t inserted;
+  // Whether an item's node, key or value couldn't be allocated.
+  int failed;
 };
 
 // Position when searching for an item.
 struct djbhash_search {
-  // Bucket ID
-  unsigned int bucket_id;
+  // Table holding the item (NULL for a small hash).
+  struct djbhash_table *table;
+  // Slot holding the item.
+  unsigned int slot;
+  // Entry holding the item.
+  unsigned int entry;
   // Whether or not the item was actually found.
   int found;
   // The item that matches.
   struct djbhash_node *item;
-  // The parent of the item that matches (for deleting).
-  struct djbhash_node *parent;
 };
 
 // Some various return functions.
@@ -78,6 +521,21 @@ enum djbhash_data_type {
   DJBHASH_HASH,
   DJBHASH_OTHER,
   DJBHASH_OTHER_MALLOCD,
+  // Arrays of other element types (DJBHASH_ARRAY holds ints); set with a count like DJBHASH_ARRAY.
+  DJBHASH_INT64_ARRAY,
+  DJBHASH_FLOAT_ARRAY,
+  DJBHASH_DOUBLE_ARRAY,
+  DJBHASH_BYTES,
+};
+
+// How a value given to djbhash_set_ownership is stored.
+enum djbhash_ownership {
+  // Copy it (what djbhash_set does).
+  DJBHASH_COPY,
+  // Adopt the caller's malloc'd string / array, or move the caller's hash.
+  DJBHASH_TAKE,
+  // Reference it; the caller frees it after removing the item.
+  DJBHASH_BORROW,
 };
 
 // Function declarations.
@@ -87,18 +545,91 @@ unsigned char *djbhash_json_array( int *array, int count );
 unsigned char *djbhash_escaped( unsigned char *data );
 unsigned char *djbhash_value_to_json( struct djbhash_node *item );
 unsigned char *djbhash_to_json( struct djbhash *hash );
+int djbhash_to_json_stream( struct djbhash *hash, djbhash_json_write_fn write, void *ctx );
+int djbhash_to_json_fd( struct djbhash *hash, int fd );
+void djbhash_json_init( struct djbhash_json_writer *writer );
+void djbhash_json_init_stream( struct djbhash_json_writer *writer, djbhash_json_write_fn write, void *ctx );
+void djbhash_json_flush( struct djbhash_json_writer *writer );
+void djbhash_json_append( struct djbhash_json_writer *writer, const void *data, size_t length );
+void djbhash_json_write_int( struct djbhash_json_writer *writer, int64_t number );
+void djbhash_json_write_double( struct djbhash_json_writer *writer, double number );
+void djbhash_json_write_string( struct djbhash_json_writer *writer, const void *data, size_t length );
+void djbhash_json_write_array( struct djbhash_json_writer *writer, int *array, int count );
+void djbhash_json_write_typed_array( struct djbhash_json_writer *writer, const void *array, int data_type, int count );
+void djbhash_json_write_value( struct djbhash_json_writer *writer, struct djbhash_node *item );
+void djbhash_json_write_hash( struct djbhash_json_writer *writer, struct djbhash *hash );
+unsigned char *djbhash_json_finish( struct djbhash_json_writer *writer, int *ok );
+int djbhash_from_json( struct djbhash *hash, const char *json, size_t length );
+int djbhash_from_json_file( struct djbhash *hash, const char *path );
 void djbhash_print_value( struct djbhash_node *item );
 void djbhash_print( struct djbhash_node *item );
 void djbhash_init( struct djbhash *hash );
+void djbhash_init_capacity( struct djbhash *hash, unsigned int capacity );
 unsigned int djb_hash( char *key, int length );
-struct djbhash_search djbhash_bin_search( struct djbhash *hash, unsigned int min, unsigned int max, unsigned int bucket_id, char *key, int length );
-void *djbhash_value( void *value, int data_type, int count );
+int djbhash_set_hash_function( struct djbhash *hash, int function, uint64_t seed );
+uint64_t djbhash_hash_key( struct djbhash *hash, const void *key, size_t length );
+uint64_t djbhash_wy_hash( const void *key, size_t length, uint64_t seed );
+void djbhash_reserve( struct djbhash *hash, unsigned int count );
+void djbhash_init_arena( struct djbhash *hash );
+void djbhash_init_cache( struct djbhash *hash, unsigned int max_entries, size_t max_bytes );
+void djbhash_cache_on_evict( struct djbhash *hash, djbhash_evict_fn evict, void *ctx );
+size_t djbhash_node_bytes( struct djbhash_node *item );
+void djbhash_cache_charge( struct djbhash *hash, struct djbhash_node *item );
 int djbhash_set( struct djbhash *hash, char *key, void *value, int data_type, ... );
+int djbhash_set_n( struct djbhash *hash, const void *key, size_t length, void *value, int data_type, ... );
+int djbhash_set_hashed( struct djbhash *hash, const void *key, size_t length, uint64_t hash_value, void *value, int data_type, int count );
+int djbhash_set_take( struct djbhash *hash, char *key, void *value, int data_type, ... );
+int djbhash_set_borrow( struct djbhash *hash, char *key, void *value, int data_type, ... );
+int djbhash_set_ownership( struct djbhash *hash, const void *key, size_t length, uint64_t hash_value, void *value, int data_type, int count, int ownership );
+struct djbhash_node *djbhash_emplace_n( struct djbhash *hash, const void *key, size_t length, int *added );
 struct djbhash_node *djbhash_find( struct djbhash *hash, char *key );
+struct djbhash_node *djbhash_find_n( struct djbhash *hash, const void *key, size_t length );
+struct djbhash_node *djbhash_find_hashed( struct djbhash *hash, const void *key, size_t length, uint64_t hash_value );
+void djbhash_find_many( struct djbhash *hash, char **keys, size_t *lengths, size_t n, struct djbhash_node **results );
+int djbhash_set_many( struct djbhash *hash, char **keys, size_t *lengths, void **values, int *data_types, int *counts, size_t n );
+int djbhash_build( struct djbhash *hash, char **keys, void **values, int *data_types, int *counts, size_t n, int threads );
 int djbhash_remove( struct djbhash *hash, char *key );
+int djbhash_remove_n( struct djbhash *hash, const void *key, size_t length );
+int djbhash_remove_hashed( struct djbhash *hash, const void *key, size_t length, uint64_t hash_value );
+uint64_t djbhash_u64_hash( struct djbhash *hash, uint64_t key );
+uint64_t djbhash_key_u64( struct djbhash_node *item );
+int djbhash_set_u64( struct djbhash *hash, uint64_t key, void *value, int data_type, ... );
+struct djbhash_node *djbhash_find_u64( struct djbhash *hash, uint64_t key );
+int djbhash_remove_u64( struct djbhash *hash, uint64_t key );
 void djbhash_dump( struct djbhash *hash );
+void djbhash_stats( struct djbhash *hash, struct djbhash_stats *stats );
+void djbhash_stats_reset( struct djbhash *hash );
+unsigned int djbhash_cursor_size( struct djbhash *hash );
+void djbhash_cursor_init( struct djbhash *hash, struct djbhash_cursor *cursor );
+void djbhash_cursor_range( struct djbhash *hash, struct djbhash_cursor *cursor, unsigned int part, unsigned int parts );
+void djbhash_cursor_seek( struct djbhash *hash, struct djbhash_cursor *cursor, struct djbhash_node *item );
+struct djbhash_node *djbhash_cursor_next( struct djbhash *hash, struct djbhash_cursor *cursor );
 struct djbhash_node *djbhash_iterate( struct djbhash *hash );
 void djbhash_reset_iterator( struct djbhash *hash );
+int djbhash_parallel_for( struct djbhash *hash, djbhash_parallel_fn fn, void *ctx, int threads, int flags );
+int djbhash_parallel_reduce( struct djbhash *hash, djbhash_reduce_fn reduce, djbhash_combine_fn combine, void *ctx, void *result, size_t size, int threads, int flags );
 void djbhash_free_node( struct djbhash_node *item );
 void djbhash_empty( struct djbhash *hash );
 void djbhash_destroy( struct djbhash *hash );
+void djbhash_intern_init( struct djbhash_intern *pool, int function, uint64_t seed );
+const char *djbhash_intern_hashed( struct djbhash_intern *pool, const void *key, size_t length, uint64_t hash_value );
+const char *djbhash_intern( struct djbhash_intern *pool, const void *key, size_t length );
+int djbhash_use_intern( struct djbhash *hash, struct djbhash_intern *pool );
+struct djbhash_node *djbhash_find_interned( struct djbhash *hash, const char *key );
+int djbhash_set_interned( struct djbhash *hash, const char *key, void *value, int data_type, ... );
+void djbhash_intern_destroy( struct djbhash_intern *pool );
+int djbhash_save( struct djbhash *hash, const char *path );
+int djbhash_open_mmap( struct djbhash *hash, const char *path );
+void djbhash_concurrent_init( struct djbhash_concurrent *hash, unsigned int shards );
+int djbhash_concurrent_set_hash_function( struct djbhash_concurrent *hash, int function, uint64_t seed );
+int djbhash_concurrent_set( struct djbhash_concurrent *hash, char *key, void *value, int data_type, ... );
+int djbhash_concurrent_find( struct djbhash_concurrent *hash, char *key, djbhash_concurrent_fn fn, void *ctx );
+int djbhash_concurrent_remove( struct djbhash_concurrent *hash, char *key );
+unsigned int djbhash_concurrent_count( struct djbhash_concurrent *hash );
+void djbhash_concurrent_destroy( struct djbhash_concurrent *hash );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
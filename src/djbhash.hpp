@@ -0,0 +1,320 @@
+// Typed C++ wrapper around djbhash: djb::hash_map<V> maps string keys to values of type V (C++17).
+#ifndef DJBHASH_HPP
+#define DJBHASH_HPP
+
+#include "djbhash.h"
+#include <cstddef>
+#include <cstring>
+#include <initializer_list>
+#include <iterator>
+#include <new>
+#include <stdexcept>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+namespace djb {
+
+namespace detail {
+
+// How a value of type V lives in a node: a heap object the map owns, behind a borrowed DJBHASH_OTHER
+//   pointer the C side never frees.
+template <class V, class = void>
+struct storage {
+  static V *get( djbhash_node *item ) { return static_cast<V *>( item->value ); }
+
+  template <class... Args>
+  static void construct( djbhash_node *item, Args &&...args )
+  {
+    item->value = new V( std::forward<Args>( args )... );
+  }
+
+  static void destroy( djbhash_node *item )
+  {
+    delete get( item );
+    item->value = nullptr;
+  }
+};
+
+// Small trivially copyable values are stored inside the node instead. ints and doubles get their C data
+//   type, so djbhash_print, JSON output and snapshots of the underlying hash understand them.
+template <class V>
+struct storage<V, std::enable_if_t<std::is_trivially_copyable_v<V> && sizeof( V ) <= sizeof( djbhash_inline ) && alignof( V ) <= alignof( djbhash_inline )>> {
+  static V *get( djbhash_node *item ) { return std::launder( reinterpret_cast<V *>( &item->data ) ); }
+
+  template <class... Args>
+  static void construct( djbhash_node *item, Args &&...args )
+  {
+    ::new ( static_cast<void *>( &item->data ) ) V( std::forward<Args>( args )... );
+    item->value = &item->data;
+    item->data_type = std::is_same_v<V, int> ? DJBHASH_INT : std::is_same_v<V, double> ? DJBHASH_DOUBLE : DJBHASH_OTHER;
+    item->flags &= ~DJBHASH_NODE_BORROWED;
+  }
+
+  static void destroy( djbhash_node *item ) { item->value = nullptr; }
+};
+
+// Key pointer for the C functions (a default constructed string_view has none).
+inline const char *key_data( std::string_view key ) { return key.data() != nullptr ? key.data() : ""; }
+
+}  // namespace detail
+
+// Hash map from strings to V. Lookups take std::string_view, so std::string, string literals and slices
+//   of larger buffers are all looked up without building a std::string. Items come back in insertion order.
+//   Like std::unordered_map, inserting may invalidate iterators; erasing only invalidates the erased one
+//   (iterators into a small hash look up where their item moved to as they advance).
+template <class V>
+class hash_map {
+  using storage = detail::storage<V>;
+
+public:
+  using key_type = std::string_view;
+  using mapped_type = V;
+  using size_type = std::size_t;
+
+  // Iterator over (key, value reference) pairs. The pairs are built on dereference rather than stored, so it
+  //   only meets the input iterator requirements (the map can still be traversed any number of times).
+  template <bool Const>
+  class basic_iterator {
+  public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type = std::pair<std::string_view, V>;
+    using difference_type = std::ptrdiff_t;
+    using reference = std::pair<std::string_view, std::conditional_t<Const, const V &, V &>>;
+
+    // What operator-> hands out: the pair lives in the proxy.
+    struct pointer {
+      reference pair;
+      const reference *operator->() const { return &pair; }
+    };
+
+    basic_iterator() = default;
+
+    // Iterators convert to const iterators.
+    template <bool C = Const, class = std::enable_if_t<C>>
+    basic_iterator( const basic_iterator<false> &other ) : hash_( other.hash_ ), cursor_( other.cursor_ ), item_( other.item_ ) {}
+
+    reference operator*() const { return reference( std::string_view( item_->key, item_->length ), *storage::get( item_ ) ); }
+    pointer operator->() const { return pointer{ **this }; }
+
+    basic_iterator &operator++()
+    {
+      // Erasing from a small hash shifts the items after it down, so carry on from wherever this one is now.
+      if ( item_ != nullptr )
+        djbhash_cursor_seek( hash_, &cursor_, item_ );
+      item_ = djbhash_cursor_next( hash_, &cursor_ );
+      return *this;
+    }
+
+    basic_iterator operator++( int )
+    {
+      basic_iterator old = *this;
+      ++*this;
+      return old;
+    }
+
+    friend bool operator==( const basic_iterator &a, const basic_iterator &b ) { return a.item_ == b.item_; }
+    friend bool operator!=( const basic_iterator &a, const basic_iterator &b ) { return a.item_ != b.item_; }
+
+  private:
+    friend class hash_map;
+    template <bool> friend class basic_iterator;
+
+    // Iterator at the first item from traversal position `pos` on.
+    basic_iterator( djbhash *hash, unsigned int pos ) : hash_( hash )
+    {
+      cursor_.pos = pos;
+      cursor_.end = UINT_MAX;
+      ++*this;
+    }
+
+    // Iterator at `item`.
+    basic_iterator( djbhash *hash, djbhash_node *item ) : hash_( hash ), item_( item ) { djbhash_cursor_init( hash, &cursor_ ); }
+
+    djbhash *hash_ = nullptr;
+    djbhash_cursor cursor_{};
+    djbhash_node *item_ = nullptr;
+  };
+
+  using iterator = basic_iterator<false>;
+  using const_iterator = basic_iterator<true>;
+
+  hash_map() { djbhash_init( &hash_ ); }
+  explicit hash_map( size_type capacity ) { djbhash_init_capacity( &hash_, static_cast<unsigned int>( capacity ) ); }
+
+  hash_map( std::initializer_list<std::pair<std::string_view, V>> items ) : hash_map( items.size() )
+  {
+    for ( const auto &item : items )
+      insert_or_assign( item.first, item.second );
+  }
+
+  hash_map( const hash_map &other ) : hash_map( other.size() )
+  {
+    for ( const auto &item : other )
+      try_emplace( item.first, item.second );
+  }
+
+  // Moving hands over the C hash itself; no item or value is touched.
+  hash_map( hash_map &&other ) noexcept
+  {
+    std::memcpy( static_cast<void *>( &hash_ ), &other.hash_, sizeof( djbhash ) );
+    djbhash_init( &other.hash_ );
+  }
+
+  hash_map &operator=( hash_map other ) noexcept
+  {
+    swap( other );
+    return *this;
+  }
+
+  ~hash_map()
+  {
+    destroy_values();
+    djbhash_destroy( &hash_ );
+  }
+
+  void swap( hash_map &other ) noexcept
+  {
+    djbhash temp;
+    std::memcpy( static_cast<void *>( &temp ), &hash_, sizeof( djbhash ) );
+    std::memcpy( static_cast<void *>( &hash_ ), &other.hash_, sizeof( djbhash ) );
+    std::memcpy( static_cast<void *>( &other.hash_ ), &temp, sizeof( djbhash ) );
+  }
+
+  size_type size() const noexcept { return hash_.count; }
+  bool empty() const noexcept { return hash_.count == 0; }
+  void reserve( size_type count ) { djbhash_reserve( &hash_, static_cast<unsigned int>( count ) ); }
+
+  iterator begin() noexcept { return iterator( &hash_, 0u ); }
+  iterator end() noexcept { return iterator(); }
+  const_iterator begin() const noexcept { return const_iterator( c_hash(), 0u ); }
+  const_iterator end() const noexcept { return const_iterator(); }
+  const_iterator cbegin() const noexcept { return begin(); }
+  const_iterator cend() const noexcept { return end(); }
+
+  iterator find( std::string_view key )
+  {
+    djbhash_node *item = lookup( key );
+    return item != nullptr ? iterator( &hash_, item ) : end();
+  }
+
+  const_iterator find( std::string_view key ) const
+  {
+    djbhash_node *item = lookup( key );
+    return item != nullptr ? const_iterator( c_hash(), item ) : end();
+  }
+
+  bool contains( std::string_view key ) const { return lookup( key ) != nullptr; }
+  size_type count( std::string_view key ) const { return lookup( key ) != nullptr ? 1 : 0; }
+
+  V &at( std::string_view key )
+  {
+    djbhash_node *item = lookup( key );
+    if ( item == nullptr )
+      throw std::out_of_range( "djb::hash_map::at" );
+    return *storage::get( item );
+  }
+
+  const V &at( std::string_view key ) const { return const_cast<hash_map *>( this )->at( key ); }
+
+  V &operator[]( std::string_view key ) { return *storage::get( emplace_node( key ).first ); }
+
+  // Construct a value from `args` in place, unless the key is already there (then nothing is moved from).
+  template <class... Args>
+  std::pair<iterator, bool> try_emplace( std::string_view key, Args &&...args )
+  {
+    std::pair<djbhash_node *, bool> result = emplace_node( key, std::forward<Args>( args )... );
+    return { iterator( &hash_, result.first ), result.second };
+  }
+
+  // Set a key to `value`, assigning over the current value if there is one.
+  template <class M>
+  std::pair<iterator, bool> insert_or_assign( std::string_view key, M &&value )
+  {
+    std::pair<djbhash_node *, bool> result = emplace_node( key, std::forward<M>( value ) );
+    if ( !result.second )
+      *storage::get( result.first ) = std::forward<M>( value );
+    return { iterator( &hash_, result.first ), result.second };
+  }
+
+  size_type erase( std::string_view key )
+  {
+    djbhash_node *item = lookup( key );
+    if ( item == nullptr )
+      return 0;
+    remove( item );
+    return 1;
+  }
+
+  // Erase the item at `pos` and return an iterator to the one after it.
+  iterator erase( const_iterator pos )
+  {
+    djbhash_cursor cursor = pos.cursor_;
+    djbhash_cursor_seek( &hash_, &cursor, pos.item_ );
+    remove( pos.item_ );
+    // Removal leaves a hole or (in small hashes) shifts the rest down, so the next item is found from here.
+    return iterator( &hash_, cursor.pos - 1 );
+  }
+
+  void clear() noexcept
+  {
+    destroy_values();
+    djbhash_empty( &hash_ );
+  }
+
+  // The underlying C hash, for djbhash_stats, djbhash_to_json and the like. Don't modify it through C calls.
+  djbhash *c_hash() const noexcept { return const_cast<djbhash *>( &hash_ ); }
+
+private:
+  djbhash_node *lookup( std::string_view key ) const { return djbhash_find_n( c_hash(), detail::key_data( key ), key.size() ); }
+
+  // Find or add the item for a key (and whether it was added); new items get a value built from `args`.
+  template <class... Args>
+  std::pair<djbhash_node *, bool> emplace_node( std::string_view key, Args &&...args )
+  {
+    int added;
+    djbhash_node *item = djbhash_emplace_n( &hash_, detail::key_data( key ), key.size(), &added );
+    if ( item == nullptr )
+      throw std::bad_alloc();
+    if ( added )
+    {
+      try
+      {
+        storage::construct( item, std::forward<Args>( args )... );
+      } catch ( ... )
+      {
+        djbhash_remove_hashed( &hash_, item->key, item->length, item->hash );
+        throw;
+      }
+    }
+    return { item, added != 0 };
+  }
+
+  void remove( djbhash_node *item )
+  {
+    storage::destroy( item );
+    djbhash_remove_hashed( &hash_, item->key, item->length, item->hash );
+  }
+
+  void destroy_values() noexcept
+  {
+    djbhash_cursor cursor;
+    djbhash_node *item;
+
+    djbhash_cursor_init( &hash_, &cursor );
+    while ( ( item = djbhash_cursor_next( &hash_, &cursor ) ) != nullptr )
+      storage::destroy( item );
+  }
+
+  djbhash hash_;
+};
+
+template <class V>
+void swap( hash_map<V> &a, hash_map<V> &b ) noexcept
+{
+  a.swap( b );
+}
+
+}  // namespace djb
+
+#endif
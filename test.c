@@ -5,6 +5,807 @@ struct test_struct {
   int b;
 };
 
+// Failed checks so far.
+static int failures = 0;
+
+// Report a failed check; tests keep going so one run shows every failure.
+#define CHECK( cond ) \
+  do \
+  { \
+    if ( !( cond ) ) \
+    { \
+      printf( "FAILED %s:%d: %s\n", __FILE__, __LINE__, #cond ); \
+      failures++; \
+    } \
+  } while ( 0 )
+
+// Fill a hash with "key<i>" => i for i in [0, n).
+static void fill( struct djbhash *hash, int n )
+{
+  char key[32];
+  int i;
+
+  for ( i = 0; i < n; i++ )
+  {
+    sprintf( key, "key%d", i );
+    djbhash_set( hash, key, &i, DJBHASH_INT );
+  }
+}
+
+// Whether "key<i>" holds i for every i in [from, to) (step `step`).
+static int holds( struct djbhash *hash, int from, int to, int step )
+{
+  struct djbhash_node *item;
+  char key[32];
+  int i;
+
+  for ( i = from; i < to; i += step )
+  {
+    sprintf( key, "key%d", i );
+    item = djbhash_find( hash, key );
+    if ( item == NULL || *( int * )item->value != i )
+      return false;
+  }
+  return true;
+}
+
+// Open addressing table: growth, updates, removals and reinserts (incremental resize included).
+static void test_table( void )
+{
+  struct djbhash hash;
+  char key[32];
+  int i, value;
+
+  djbhash_init( &hash );
+  fill( &hash, 20000 );
+  CHECK( hash.count == 20000 );
+  CHECK( holds( &hash, 0, 20000, 1 ) );
+  for ( i = 0; i < 20000; i += 2 )
+  {
+    sprintf( key, "key%d", i );
+    CHECK( djbhash_remove( &hash, key ) );
+  }
+  CHECK( !djbhash_remove( &hash, "key0" ) );
+  CHECK( hash.count == 10000 );
+  CHECK( djbhash_find( &hash, "key0" ) == NULL );
+  CHECK( holds( &hash, 1, 20000, 2 ) );
+  value = -1;
+  djbhash_set( &hash, "key1", &value, DJBHASH_INT );
+  CHECK( *( int * )djbhash_find( &hash, "key1" )->value == -1 && hash.count == 10000 );
+  fill( &hash, 20000 );
+  CHECK( hash.count == 20000 && holds( &hash, 0, 20000, 1 ) );
+  djbhash_destroy( &hash );
+
+  // Pre-sized tables and reserve.
+  djbhash_init_capacity( &hash, 5000 );
+  djbhash_reserve( &hash, 10000 );
+  fill( &hash, 10000 );
+  CHECK( holds( &hash, 0, 10000, 1 ) );
+  djbhash_destroy( &hash );
+}
+
+// Small hashes live in the inline array and move to a slot table once they outgrow it.
+static void test_small( void )
+{
+  struct djbhash hash;
+
+  djbhash_init( &hash );
+  fill( &hash, DJBHASH_SMALL_MAX );
+  CHECK( hash.table.capacity == 0 && holds( &hash, 0, DJBHASH_SMALL_MAX, 1 ) );
+  CHECK( djbhash_remove( &hash, "key3" ) && djbhash_find( &hash, "key3" ) == NULL && holds( &hash, 4, DJBHASH_SMALL_MAX, 1 ) );
+  fill( &hash, DJBHASH_SMALL_MAX + 1 );
+  CHECK( hash.table.capacity > 0 && holds( &hash, 0, DJBHASH_SMALL_MAX + 1, 1 ) );
+  djbhash_destroy( &hash );
+}
+
+// Values and keys inside the node, and the cached hash and key length.
+static void test_node( void )
+{
+  struct djbhash hash;
+  struct djbhash_node *item;
+  char long_key[100], long_value[100];
+  double d;
+
+  djbhash_init( &hash );
+  memset( long_key, 'k', sizeof( long_key ) - 1 );
+  long_key[sizeof( long_key ) - 1] = '\0';
+  memset( long_value, 'v', sizeof( long_value ) - 1 );
+  long_value[sizeof( long_value ) - 1] = '\0';
+  djbhash_set( &hash, "short", "abc", DJBHASH_STRING );
+  djbhash_set( &hash, long_key, long_value, DJBHASH_STRING );
+  d = 2.5;
+  djbhash_set( &hash, "d", &d, DJBHASH_DOUBLE );
+  item = djbhash_find( &hash, "short" );
+  CHECK( item->key == item->key_data && item->value == item->data.string && strcmp( item->value, "abc" ) == 0 );
+  CHECK( item->length == 5 && item->hash == djbhash_hash_key( &hash, "short", 5 ) );
+  item = djbhash_find( &hash, long_key );
+  CHECK( item->key != item->key_data && strcmp( item->value, long_value ) == 0 && item->length == 99 );
+  CHECK( *( double * )djbhash_find( &hash, "d" )->value == 2.5 );
+  djbhash_destroy( &hash );
+}
+
+// Arena hashes, including nested hashes and reuse after a reset.
+static void test_arena( void )
+{
+  struct djbhash hash, nested;
+
+  djbhash_init_arena( &hash );
+  fill( &hash, 5000 );
+  djbhash_init( &nested );
+  fill( &nested, 10 );
+  djbhash_set( &hash, "nested", &nested, DJBHASH_HASH );
+  CHECK( holds( &hash, 0, 5000, 1 ) && holds( djbhash_find( &hash, "nested" )->value, 0, 10, 1 ) );
+  CHECK( djbhash_remove( &hash, "key7" ) && djbhash_find( &hash, "key7" ) == NULL );
+  djbhash_empty( &hash );
+  CHECK( hash.count == 0 && djbhash_find( &hash, "key1" ) == NULL );
+  fill( &hash, 100 );
+  CHECK( holds( &hash, 0, 100, 1 ) );
+  djbhash_destroy( &nested );
+  djbhash_destroy( &hash );
+}
+
+// Seeded hash functions, byte slice keys and pre-hashed keys.
+static void test_keys( void )
+{
+  struct djbhash hash;
+  const char *buffer = "xxalphayy";
+  uint64_t hash_value;
+  int value;
+
+  djbhash_init( &hash );
+  CHECK( djbhash_set_hash_function( &hash, DJBHASH_FUNCTION_WY, 12345 ) );
+  CHECK( djbhash_hash_key( &hash, "abc", 3 ) != djbhash_wy_hash( "abc", 3, 54321 ) );
+  fill( &hash, 1000 );
+  CHECK( !djbhash_set_hash_function( &hash, DJBHASH_FUNCTION_DJB2, 0 ) );
+  CHECK( holds( &hash, 0, 1000, 1 ) );
+
+  // Slices need not be NUL terminated, and may contain NULs.
+  value = 1;
+  djbhash_set_n( &hash, buffer + 2, 5, &value, DJBHASH_INT );
+  CHECK( djbhash_find( &hash, "alpha" ) != NULL && djbhash_find_n( &hash, buffer + 2, 4 ) == NULL );
+  djbhash_set_n( &hash, "a\0b", 3, &value, DJBHASH_INT );
+  CHECK( djbhash_find_n( &hash, "a\0b", 3 ) != NULL && djbhash_find_n( &hash, "a\0c", 3 ) == NULL );
+  hash_value = djbhash_hash_key( &hash, "pre", 3 );
+  djbhash_set_hashed( &hash, "pre", 3, hash_value, &value, DJBHASH_INT, 0 );
+  CHECK( djbhash_find_hashed( &hash, "pre", 3, hash_value ) == djbhash_find( &hash, "pre" ) );
+  CHECK( djbhash_remove_n( &hash, buffer + 2, 5 ) && djbhash_remove_hashed( &hash, "pre", 3, hash_value ) );
+  CHECK( djbhash_find( &hash, "alpha" ) == NULL && djbhash_find( &hash, "pre" ) == NULL );
+  djbhash_destroy( &hash );
+}
+
+// Batched finds and sets agree with the single key calls.
+static void test_batch( void )
+{
+  struct djbhash hash;
+  struct djbhash_node *results[100];
+  char *keys[100], names[100][16];
+  void *values[100];
+  int data_types[100], numbers[100], i, ok;
+
+  djbhash_init( &hash );
+  for ( i = 0; i < 100; i++ )
+  {
+    sprintf( names[i], "key%d", i % 2 ? i : i + 1000 );
+    keys[i] = names[i];
+    numbers[i] = i;
+    values[i] = &numbers[i];
+    data_types[i] = DJBHASH_INT;
+  }
+  CHECK( djbhash_set_many( &hash, keys, NULL, values, data_types, NULL, 100 ) );
+  fill( &hash, 50 );
+  djbhash_find_many( &hash, keys, NULL, 100, results );
+  ok = true;
+  for ( i = 0; i < 100; i++ )
+    ok = ok && results[i] == djbhash_find( &hash, keys[i] ) && results[i] != NULL;
+  CHECK( ok );
+  djbhash_destroy( &hash );
+
+  // Sets into a mapped hash fail, and so does the batch.
+  djbhash_init( &hash );
+  djbhash_set( &hash, "key", "value", DJBHASH_STRING );
+  CHECK( djbhash_save( &hash, "/tmp/djbhash_test_batch.img" ) );
+  djbhash_destroy( &hash );
+  CHECK( djbhash_open_mmap( &hash, "/tmp/djbhash_test_batch.img" ) );
+  CHECK( !djbhash_set_many( &hash, keys, NULL, values, data_types, NULL, 100 ) && hash.count == 1 );
+  djbhash_destroy( &hash );
+  remove( "/tmp/djbhash_test_batch.img" );
+}
+
+// Callback counting the items a concurrent find sees.
+static void count_item( struct djbhash_node *item, void *ctx )
+{
+  ( *( int * )ctx )++;
+}
+
+// Shared state of the concurrent hash test.
+struct concurrent_test {
+  struct djbhash_concurrent *hash;
+  int thread;
+};
+
+// Set, find and remove a thread's own keys.
+static void *concurrent_worker( void *arg )
+{
+  struct concurrent_test *test;
+  char key[32];
+  int i, found;
+
+  test = arg;
+  found = 0;
+  for ( i = 0; i < 2000; i++ )
+  {
+    sprintf( key, "t%d-%d", test->thread, i );
+    djbhash_concurrent_set( test->hash, key, &i, DJBHASH_INT );
+  }
+  for ( i = 0; i < 2000; i++ )
+  {
+    sprintf( key, "t%d-%d", test->thread, i );
+    djbhash_concurrent_find( test->hash, key, count_item, &found );
+    if ( i % 2 )
+      djbhash_concurrent_remove( test->hash, key );
+  }
+  return found == 2000 ? arg : NULL;
+}
+
+// Sharded concurrent hash used from several threads.
+static void test_concurrent( void )
+{
+  struct djbhash_concurrent hash;
+  struct concurrent_test tests[4];
+  pthread_t threads[4];
+  void *result;
+  int i, seen;
+
+  djbhash_concurrent_init( &hash, 8 );
+  for ( i = 0; i < 4; i++ )
+  {
+    tests[i].hash = &hash;
+    tests[i].thread = i;
+    pthread_create( &threads[i], NULL, concurrent_worker, &tests[i] );
+  }
+  for ( i = 0; i < 4; i++ )
+  {
+    pthread_join( threads[i], &result );
+    CHECK( result == &tests[i] );
+  }
+  CHECK( djbhash_concurrent_count( &hash ) == 4000 );
+  seen = 0;
+  CHECK( djbhash_concurrent_find( &hash, "t0-0", count_item, &seen ) && seen == 1 );
+  CHECK( !djbhash_concurrent_find( &hash, "t0-1", count_item, &seen ) );
+  djbhash_concurrent_destroy( &hash );
+}
+
+// Cursors, ranges and the built-in iterator walk items in insertion order.
+static void test_cursors( void )
+{
+  struct djbhash hash;
+  struct djbhash_cursor cursor;
+  struct djbhash_node *item;
+  char key[32];
+  int i, expected, ok, seen, part;
+
+  djbhash_init( &hash );
+  fill( &hash, 3000 );
+  for ( i = 0; i < 3000; i += 3 )
+  {
+    sprintf( key, "key%d", i );
+    djbhash_remove( &hash, key );
+  }
+  // Updating keeps an item's place; reinserting moves it to the end.
+  djbhash_set( &hash, "key1", &i, DJBHASH_INT );
+  i = 0;
+  djbhash_set( &hash, "key0", &i, DJBHASH_INT );
+
+  djbhash_cursor_init( &hash, &cursor );
+  expected = 1;
+  ok = true;
+  while ( ( item = djbhash_cursor_next( &hash, &cursor ) ) != NULL && strcmp( item->key, "key0" ) != 0 )
+  {
+    sprintf( key, "key%d", expected );
+    ok = ok && strcmp( item->key, key ) == 0;
+    expected += expected % 3 == 1 ? 1 : 2;
+  }
+  CHECK( ok && item != NULL && djbhash_cursor_next( &hash, &cursor ) == NULL );
+
+  seen = 0;
+  for ( part = 0; part < 7; part++ )
+  {
+    djbhash_cursor_range( &hash, &cursor, part, 7 );
+    while ( djbhash_cursor_next( &hash, &cursor ) != NULL )
+      seen++;
+  }
+  CHECK( seen == ( int )hash.count );
+
+  seen = 0;
+  djbhash_reset_iterator( &hash );
+  while ( djbhash_iterate( &hash ) != NULL )
+    seen++;
+  CHECK( seen == ( int )hash.count );
+
+  // Seeking past an item carries on after it, wherever the cursor was.
+  djbhash_cursor_init( &hash, &cursor );
+  djbhash_cursor_seek( &hash, &cursor, djbhash_find( &hash, "key1" ) );
+  item = djbhash_cursor_next( &hash, &cursor );
+  CHECK( item != NULL && strcmp( item->key, "key2" ) == 0 );
+  djbhash_cursor_seek( &hash, &cursor, djbhash_find( &hash, "key0" ) );
+  CHECK( djbhash_cursor_next( &hash, &cursor ) == NULL );
+
+  // emplace_n adds an empty item once, then finds it.
+  item = djbhash_emplace_n( &hash, "fresh", 5, &ok );
+  CHECK( item != NULL && ok && item->value == NULL && hash.count == 2002 );
+  CHECK( djbhash_emplace_n( &hash, "fresh", 5, &ok ) == item && !ok );
+  djbhash_destroy( &hash );
+}
+
+// Collects streamed JSON output.
+static int collect_json( void *ctx, const void *data, size_t length )
+{
+  struct djbhash_json_writer *copy;
+
+  copy = ctx;
+  djbhash_json_append( copy, data, length );
+  return true;
+}
+
+// JSON output: escaping, numbers, nesting, and streaming giving the same text.
+static void test_json_writer( void )
+{
+  struct djbhash hash, nested;
+  struct djbhash_json_writer copy;
+  unsigned char *json, *streamed;
+  double d;
+  int i, ok;
+
+  djbhash_init( &hash );
+  djbhash_set( &hash, "s", "a\"b\\c\n\x01", DJBHASH_STRING );
+  i = -2147483647 - 1;
+  djbhash_set( &hash, "i", &i, DJBHASH_INT );
+  d = 0.1;
+  djbhash_set( &hash, "d", &d, DJBHASH_DOUBLE );
+  d = 3;
+  djbhash_set( &hash, "whole", &d, DJBHASH_DOUBLE );
+  djbhash_init( &nested );
+  djbhash_set( &nested, "x", "y", DJBHASH_STRING );
+  djbhash_set( &hash, "h", &nested, DJBHASH_HASH );
+  djbhash_set( &hash, "null", NULL, DJBHASH_OTHER );
+  json = djbhash_to_json( &hash );
+  CHECK( strcmp( ( char * )json, "{\"s\":\"a\\\"b\\\\c\\n\\u0001\",\"i\":-2147483648,\"d\":0.1,\"whole\":3.0,\"h\":{\"x\":\"y\"},\"null\":null}" ) == 0 );
+
+  free( json );
+
+  // Doubles far outside int64_t's range, and floats.
+  djbhash_empty( &hash );
+  d = 1e300;
+  djbhash_set( &hash, "big", &d, DJBHASH_DOUBLE );
+  d = -1e300;
+  djbhash_set( &hash, "small", &d, DJBHASH_DOUBLE );
+  d = 1e15;
+  djbhash_set( &hash, "edge", &d, DJBHASH_DOUBLE );
+  json = djbhash_to_json( &hash );
+  CHECK( strcmp( ( char * )json, "{\"big\":1e+300,\"small\":-1e+300,\"edge\":1e+15}" ) == 0 );
+
+  fill( &hash, 20000 );
+  free( json );
+  json = djbhash_to_json( &hash );
+  djbhash_json_init( &copy );
+  CHECK( djbhash_to_json_stream( &hash, collect_json, &copy ) );
+  streamed = djbhash_json_finish( &copy, &ok );
+  CHECK( ok && strcmp( ( char * )json, ( char * )streamed ) == 0 );
+  free( streamed );
+  free( json );
+  djbhash_destroy( &nested );
+  djbhash_destroy( &hash );
+}
+
+// JSON round trip through djbhash_from_json.
+static void test_json_loader( void )
+{
+  struct djbhash hash;
+  struct djbhash_node *item;
+  const char *json;
+  unsigned char *out;
+
+  json = " {\"a\": 1, \"b\": [1, 2, 3], \"c\": {\"d\": \"\\u00e9\\n\"}, \"e\": 1.5e3, \"f\": [true, null, \"x\"], \"g\": false} ";
+  djbhash_init( &hash );
+  CHECK( djbhash_from_json( &hash, json, strlen( json ) ) );
+  CHECK( *( int * )djbhash_find( &hash, "a" )->value == 1 && *( double * )djbhash_find( &hash, "e" )->value == 1500 );
+  item = djbhash_find( &hash, "b" );
+  CHECK( item->data_type == DJBHASH_ARRAY && item->count == 3 && ( ( int * )item->value )[2] == 3 );
+  item = djbhash_find( &hash, "c" );
+  CHECK( item->data_type == DJBHASH_HASH && strcmp( djbhash_find( item->value, "d" )->value, "\xc3\xa9\n" ) == 0 );
+  item = djbhash_find( &hash, "f" );
+  CHECK( item->data_type == DJBHASH_HASH && djbhash_find( item->value, "1" )->value == NULL );
+  out = djbhash_to_json( &hash );
+  CHECK( strcmp( ( char * )out, "{\"a\":1,\"b\":[1,2,3],\"c\":{\"d\":\"\xc3\xa9\\n\"},\"e\":1500.0,\"f\":{\"0\":1,\"1\":null,\"2\":\"x\"},\"g\":0}" ) == 0 );
+  free( out );
+  djbhash_empty( &hash );
+  CHECK( !djbhash_from_json( &hash, "{\"a\":", 5 ) && !djbhash_from_json( &hash, "[1]", 3 ) );
+  CHECK( hash.count == 0 );
+
+  // Numerals of any length, and empty arrays.
+  json = "{\"long\":1.00000000000000000000000000000000000000000000000000000000000000000000000000000000000001e2,\"empty\":[]}";
+  CHECK( djbhash_from_json( &hash, json, strlen( json ) ) );
+  CHECK( *( double * )djbhash_find( &hash, "long" )->value == 100 && djbhash_find( &hash, "empty" )->count == 0 );
+
+  // A failed load keeps what the hash held, and a good one adds to it.
+  json = "{\"long\":1,\"new\":{\"x\":1},";
+  CHECK( !djbhash_from_json( &hash, json, strlen( json ) ) );
+  CHECK( hash.count == 2 && *( double * )djbhash_find( &hash, "long" )->value == 100 && djbhash_find( &hash, "new" ) == NULL );
+  json = "{\"long\":1,\"new\":{\"x\":1}}";
+  CHECK( djbhash_from_json( &hash, json, strlen( json ) ) );
+  CHECK( hash.count == 3 && *( int * )djbhash_find( &hash, "long" )->value == 1 && djbhash_find( djbhash_find( &hash, "new" )->value, "x" ) != NULL );
+  djbhash_destroy( &hash );
+}
+
+// Look up every key of a mapped hash (threads share one).
+static void *mapped_worker( void *arg )
+{
+  return holds( arg, 0, 1000, 1 ) ? arg : NULL;
+}
+
+// Snapshots saved and mapped back.
+static void test_snapshot( void )
+{
+  struct djbhash hash, nested, mapped;
+  struct djbhash_node *item;
+  const char *path = "/tmp/djbhash_test.img";
+  int array[3] = { 4, 5, 6 };
+  struct djbhash_image_header header;
+  struct djbhash_image_table table;
+  struct djbhash_cursor cursor;
+  pthread_t threads[4];
+  FILE *file;
+  void *result;
+  int i;
+
+  djbhash_init( &hash );
+  fill( &hash, 1000 );
+  djbhash_set( &hash, "array", array, DJBHASH_ARRAY, 3 );
+  djbhash_init( &nested );
+  djbhash_set( &nested, "inner", "value", DJBHASH_STRING );
+  djbhash_set( &hash, "nested", &nested, DJBHASH_HASH );
+  CHECK( djbhash_save( &hash, path ) );
+
+  djbhash_init( &mapped );
+  CHECK( djbhash_open_mmap( &mapped, path ) );
+  CHECK( mapped.count == hash.count && holds( &mapped, 0, 1000, 1 ) );
+  item = djbhash_find( &mapped, "array" );
+  CHECK( item != NULL && item->count == 3 && ( ( int * )item->value )[1] == 5 );
+  item = djbhash_find( &mapped, "nested" );
+  CHECK( item != NULL && strcmp( djbhash_find( item->value, "inner" )->value, "value" ) == 0 );
+  CHECK( djbhash_find( &mapped, "missing" ) == NULL && !djbhash_set( &mapped, "new", "x", DJBHASH_STRING ) );
+  djbhash_destroy( &mapped );
+
+  // Threads share a freshly mapped hash without a lock, building its nodes as they go.
+  CHECK( djbhash_open_mmap( &mapped, path ) );
+  for ( i = 0; i < 4; i++ )
+    pthread_create( &threads[i], NULL, mapped_worker, &mapped );
+  for ( i = 0; i < 4; i++ )
+  {
+    pthread_join( threads[i], &result );
+    CHECK( result == &mapped );
+  }
+  djbhash_destroy( &mapped );
+
+  // An entry whose key lies outside the image is skipped, not read.
+  file = fopen( path, "r+b" );
+  CHECK( fread( &header, sizeof( header ), 1, file ) == 1 && fseek( file, header.root, SEEK_SET ) == 0 );
+  CHECK( fread( &table, sizeof( table ), 1, file ) == 1 );
+  fseek( file, table.entries + offsetof( struct djbhash_image_entry, key ), SEEK_SET );
+  fwrite( &header.size, sizeof( header.size ), 1, file );
+  fclose( file );
+  CHECK( djbhash_open_mmap( &mapped, path ) );
+  CHECK( djbhash_find( &mapped, "key0" ) == NULL && holds( &mapped, 1, 1000, 1 ) );
+  i = 0;
+  djbhash_cursor_init( &mapped, &cursor );
+  while ( djbhash_cursor_next( &mapped, &cursor ) != NULL )
+    i++;
+  CHECK( i == ( int )hash.count - 1 );
+  djbhash_cursor_init( &mapped, &cursor );
+  djbhash_cursor_seek( &mapped, &cursor, djbhash_find( &mapped, "key998" ) );
+  CHECK( strcmp( djbhash_cursor_next( &mapped, &cursor )->key, "key999" ) == 0 );
+  djbhash_destroy( &mapped );
+  remove( path );
+  djbhash_destroy( &nested );
+  djbhash_destroy( &hash );
+}
+
+// Taken values are freed by the hash, borrowed ones left alone.
+static void test_ownership( void )
+{
+  struct djbhash hash, source;
+  char *taken, borrowed[8] = "shared";
+  int *array;
+
+  djbhash_init( &hash );
+  taken = strdup( "a string long enough to live outside the node" );
+  djbhash_set_take( &hash, "taken", taken, DJBHASH_STRING );
+  CHECK( djbhash_find( &hash, "taken" )->value == taken );
+  array = malloc( sizeof( int ) * 2 );
+  array[0] = 1;
+  array[1] = 2;
+  djbhash_set_take( &hash, "array", array, DJBHASH_ARRAY, 2 );
+  CHECK( djbhash_find( &hash, "array" )->value == array );
+  djbhash_set_borrow( &hash, "borrowed", borrowed, DJBHASH_STRING );
+  CHECK( djbhash_find( &hash, "borrowed" )->value == borrowed );
+  djbhash_init( &source );
+  fill( &source, 100 );
+  djbhash_set_take( &hash, "moved", &source, DJBHASH_HASH );
+  CHECK( source.count == 0 && holds( djbhash_find( &hash, "moved" )->value, 0, 100, 1 ) );
+  djbhash_destroy( &source );
+  djbhash_destroy( &hash );
+  CHECK( strcmp( borrowed, "shared" ) == 0 );
+}
+
+// Hashes using one intern pool share key storage and find by interned pointer.
+static void test_intern( void )
+{
+  struct djbhash_intern pool;
+  struct djbhash a, b;
+  const char *key;
+
+  djbhash_intern_init( &pool, DJBHASH_FUNCTION_WY, 7 );
+  djbhash_init( &a );
+  djbhash_init( &b );
+  CHECK( djbhash_use_intern( &a, &pool ) && djbhash_use_intern( &b, &pool ) );
+  fill( &a, 500 );
+  fill( &b, 500 );
+  CHECK( djbhash_find( &a, "key42" )->key == djbhash_find( &b, "key42" )->key );
+  key = djbhash_intern( &pool, "key42", 5 );
+  CHECK( key == djbhash_find( &a, "key42" )->key && djbhash_find_interned( &b, key ) != NULL );
+  CHECK( djbhash_set_interned( &a, key, "x", DJBHASH_STRING ) && strcmp( djbhash_find( &a, "key42" )->value, "x" ) == 0 );
+  CHECK( holds( &b, 0, 500, 1 ) );
+
+  // Long keys are stored once: the pool's index node points at the record.
+  key = djbhash_intern( &pool, "a key much longer than the inline key space", 43 );
+  CHECK( djbhash_find_n( &pool.index, key, 43 )->key == key && djbhash_intern( &pool, key, 43 ) == key );
+  djbhash_destroy( &a );
+  djbhash_destroy( &b );
+  djbhash_intern_destroy( &pool );
+}
+
+// Stats agree with what the hash holds.
+static void test_stats( void )
+{
+  struct djbhash hash, nested;
+  struct djbhash_stats stats;
+
+  djbhash_init( &hash );
+  fill( &hash, 1000 );
+  djbhash_remove( &hash, "key5" );
+  djbhash_init( &nested );
+  fill( &nested, 10 );
+  djbhash_set( &hash, "nested", &nested, DJBHASH_HASH );
+  djbhash_stats( &hash, &stats );
+  CHECK( stats.count == 1000 && stats.total_count == 1010 && stats.nested_hashes == 1 );
+  CHECK( stats.used_slots == 1000 && stats.load_factor > 0 && stats.load_factor <= 1 );
+  CHECK( stats.node_bytes == 1010 * sizeof( struct djbhash_node ) );
+  djbhash_destroy( &nested );
+  djbhash_destroy( &hash );
+}
+
+// Parallel builds give the same items, values and order as setting the inputs one by one.
+static void test_build( void )
+{
+  struct djbhash built, serial;
+  struct djbhash_cursor a, b;
+  struct djbhash_node *x, *y;
+  char **keys, *names;
+  void **values;
+  int *data_types, *numbers, i, n, same;
+
+  // Every third input repeats an earlier key, so later duplicates must win.
+  n = DJBHASH_BUILD_MIN * 3;
+  keys = malloc( sizeof( char * ) * n );
+  names = malloc( 16 * n );
+  values = malloc( sizeof( void * ) * n );
+  data_types = malloc( sizeof( int ) * n );
+  numbers = malloc( sizeof( int ) * n );
+  for ( i = 0; i < n; i++ )
+  {
+    keys[i] = names + 16 * i;
+    sprintf( keys[i], "key%d", i % 3 == 2 ? i / 7 : i );
+    numbers[i] = i;
+    values[i] = &numbers[i];
+    data_types[i] = DJBHASH_INT;
+  }
+
+  djbhash_init( &built );
+  djbhash_init( &serial );
+  CHECK( djbhash_build( &built, keys, values, data_types, NULL, n, 4 ) );
+  for ( i = 0; i < n; i++ )
+    djbhash_set( &serial, keys[i], values[i], DJBHASH_INT );
+  CHECK( built.count == serial.count );
+  djbhash_cursor_init( &built, &a );
+  djbhash_cursor_init( &serial, &b );
+  same = true;
+  do
+  {
+    x = djbhash_cursor_next( &built, &a );
+    y = djbhash_cursor_next( &serial, &b );
+    same = same && ( x == NULL ) == ( y == NULL ) && ( x == NULL || ( strcmp( x->key, y->key ) == 0 && *( int * )x->value == *( int * )y->value ) );
+  } while ( same && x != NULL );
+  CHECK( same );
+  // "key0" comes as inputs 0, 2 and 5.
+  CHECK( *( int * )djbhash_find( &built, "key0" )->value == 5 && djbhash_find( &built, "key1" ) != NULL );
+  djbhash_destroy( &built );
+  djbhash_destroy( &serial );
+  free( keys );
+  free( names );
+  free( values );
+  free( data_types );
+  free( numbers );
+}
+
+// Sum of int values for the parallel tests; accumulators must start on a cache line.
+static void sum_item( struct djbhash_node *item, void *acc, void *ctx )
+{
+  if ( ( uintptr_t )acc % DJBHASH_CACHE_LINE != 0 )
+    abort();
+  if ( item->data_type == DJBHASH_INT )
+    *( long * )acc += *( int * )item->value;
+}
+
+// Merge two sums.
+static void sum_merge( void *acc, const void *other, void *ctx )
+{
+  *( long * )acc += *( const long * )other;
+}
+
+// Parallel map-reduce, with and without nested hashes.
+static void test_parallel( void )
+{
+  struct djbhash hash, nested;
+  long total;
+
+  djbhash_init( &hash );
+  fill( &hash, 30000 );
+  djbhash_init( &nested );
+  fill( &nested, 10000 );
+  djbhash_set( &hash, "nested", &nested, DJBHASH_HASH );
+  total = 0;
+  CHECK( djbhash_parallel_reduce( &hash, sum_item, sum_merge, NULL, &total, sizeof( total ), 4, 0 ) );
+  CHECK( total == 29999L * 30000 / 2 );
+  total = 0;
+  CHECK( djbhash_parallel_reduce( &hash, sum_item, sum_merge, NULL, &total, sizeof( total ), 3, DJBHASH_PARALLEL_RECURSIVE ) );
+  CHECK( total == 29999L * 30000 / 2 + 9999L * 10000 / 2 );
+  djbhash_destroy( &nested );
+  djbhash_destroy( &hash );
+}
+
+// Typed arrays are aligned copies and survive JSON output.
+static void test_typed_arrays( void )
+{
+  struct djbhash hash;
+  struct djbhash_node *item;
+  double doubles[3] = { 0.5, -1, 1e-7 };
+  int64_t longs[2] = { INT64_MIN, INT64_MAX };
+  float floats[2] = { 0.1f, 2 };
+  unsigned char bytes[3] = { 0, 127, 255 };
+  unsigned char *json;
+
+  djbhash_init( &hash );
+  djbhash_set( &hash, "d", doubles, DJBHASH_DOUBLE_ARRAY, 3 );
+  djbhash_set( &hash, "l", longs, DJBHASH_INT64_ARRAY, 2 );
+  djbhash_set( &hash, "f", floats, DJBHASH_FLOAT_ARRAY, 2 );
+  djbhash_set( &hash, "b", bytes, DJBHASH_BYTES, 3 );
+  item = djbhash_find( &hash, "d" );
+  CHECK( item->value != doubles && ( uintptr_t )item->value % DJBHASH_ARRAY_ALIGN == 0 && ( ( double * )item->value )[2] == 1e-7 );
+  json = djbhash_to_json( &hash );
+  CHECK( strcmp( ( char * )json, "{\"d\":[0.5,-1.0,1e-07],\"l\":[-9223372036854775808,9223372036854775807],\"f\":[0.1,2.0],\"b\":[0,127,255]}" ) == 0 );
+  djbhash_empty( &hash );
+  CHECK( djbhash_from_json( &hash, ( char * )json, strlen( ( char * )json ) ) && djbhash_find( &hash, "d" )->data_type == DJBHASH_DOUBLE_ARRAY );
+  free( json );
+  djbhash_destroy( &hash );
+}
+
+// Number keys don't clash with string keys of the same digits.
+static void test_u64( void )
+{
+  struct djbhash hash, small, mapped, copy, *nested;
+  const char *path = "/tmp/djbhash_test_u64.img";
+  unsigned char *json;
+  uint64_t i;
+  int value, ok;
+
+  djbhash_init( &hash );
+  value = 1;
+  for ( i = 0; i < 5000; i++ )
+    djbhash_set_u64( &hash, i * 0x9E3779B97F4A7C15ULL, &value, DJBHASH_INT );
+  djbhash_set( &hash, "7", "string", DJBHASH_STRING );
+  djbhash_set_u64( &hash, 7, "number", DJBHASH_STRING );
+  CHECK( hash.count == 5002 );
+  CHECK( strcmp( djbhash_find( &hash, "7" )->value, "string" ) == 0 && strcmp( djbhash_find_u64( &hash, 7 )->value, "number" ) == 0 );
+  CHECK( djbhash_key_u64( djbhash_find_u64( &hash, 3 * 0x9E3779B97F4A7C15ULL ) ) == 3 * 0x9E3779B97F4A7C15ULL );
+  ok = true;
+  for ( i = 0; i < 5000; i += 2 )
+    ok = ok && djbhash_remove_u64( &hash, i * 0x9E3779B97F4A7C15ULL );
+  for ( i = 0; i < 5000; i++ )
+    ok = ok && ( djbhash_find_u64( &hash, i * 0x9E3779B97F4A7C15ULL ) != NULL ) == ( i % 2 == 1 );
+  CHECK( ok && djbhash_find_u64( &hash, 12345 ) == NULL );
+
+  // Output spells number keys out, and the hash follows the table's function and seed.
+  djbhash_init( &small );
+  djbhash_set_u64( &small, 15755400384260043839ULL, &value, DJBHASH_INT );
+  json = djbhash_to_json( &small );
+  CHECK( strcmp( ( char * )json, "{\"15755400384260043839\":1}" ) == 0 );
+  free( json );
+  i = 42;
+  CHECK( djbhash_u64_hash( &small, 42 ) == djbhash_hash_key( &small, &i, sizeof( i ) ) );
+  djbhash_empty( &small );
+  CHECK( djbhash_set_hash_function( &small, DJBHASH_FUNCTION_WY, 99 ) && djbhash_u64_hash( &small, 42 ) == djbhash_wy_hash( &i, sizeof( i ), 99 ) );
+  djbhash_destroy( &small );
+
+  // Number keys stay number keys through a snapshot, and in copies of the mapped hash.
+  CHECK( djbhash_save( &hash, path ) );
+  djbhash_init( &mapped );
+  CHECK( djbhash_open_mmap( &mapped, path ) );
+  CHECK( djbhash_find_u64( &mapped, 7 ) != NULL && strcmp( djbhash_find_u64( &mapped, 7 )->value, "number" ) == 0 );
+  djbhash_init( &copy );
+  djbhash_set( &copy, "mapped", &mapped, DJBHASH_HASH );
+  nested = djbhash_find( &copy, "mapped" )->value;
+  CHECK( nested->count == hash.count && djbhash_find_u64( nested, 7 ) != NULL && strcmp( djbhash_find_u64( nested, 7 )->value, "number" ) == 0 );
+  CHECK( djbhash_find_u64( nested, 1 * 0x9E3779B97F4A7C15ULL ) != NULL && strcmp( djbhash_find( nested, "7" )->value, "string" ) == 0 );
+  djbhash_destroy( &copy );
+  djbhash_destroy( &mapped );
+  remove( path );
+  djbhash_destroy( &hash );
+}
+
+// Cache byte accounting matches what the items take, nested hashes filled in place included.
+static void test_cache( void )
+{
+  struct djbhash hash, nested;
+  struct djbhash_cursor cursor;
+  struct djbhash_node *item;
+  struct djbhash_stats stats;
+  const char *json;
+  size_t bytes;
+  int i;
+
+  json = "{\"a\":{\"b\":{\"c\":\"a string that is too long for the node\"},\"d\":[1,\"x\",2]},\"e\":[1,2,3]}";
+  djbhash_init_cache( &hash, 0, 0 );
+  CHECK( djbhash_from_json( &hash, json, strlen( json ) ) );
+  bytes = 0;
+  djbhash_cursor_init( &hash, &cursor );
+  while ( ( item = djbhash_cursor_next( &hash, &cursor ) ) != NULL )
+    bytes += djbhash_node_bytes( item );
+  djbhash_stats( &hash, &stats );
+  CHECK( stats.cache_bytes == bytes );
+  CHECK( djbhash_remove( &hash, "a" ) && djbhash_remove( &hash, "e" ) );
+  djbhash_stats( &hash, &stats );
+  CHECK( stats.cache_bytes == 0 );
+
+  // A nested hash grown in place after it was set: removing it takes back only what was charged.
+  djbhash_init( &nested );
+  djbhash_set( &hash, "nested", &nested, DJBHASH_HASH );
+  fill( djbhash_find( &hash, "nested" )->value, 100 );
+  djbhash_remove( &hash, "nested" );
+  djbhash_stats( &hash, &stats );
+  CHECK( stats.cache_bytes == 0 );
+  djbhash_destroy( &hash );
+
+  // And a byte budget still holds many items afterwards.
+  djbhash_init_cache( &hash, 0, 100 * sizeof( struct djbhash_node ) );
+  djbhash_set( &hash, "nested", &nested, DJBHASH_HASH );
+  fill( djbhash_find( &hash, "nested" )->value, 1000 );
+  djbhash_cache_charge( &hash, djbhash_find( &hash, "nested" ) );
+  djbhash_remove( &hash, "nested" );
+  fill( &hash, 1000 );
+  djbhash_stats( &hash, &stats );
+  CHECK( hash.count >= 90 && hash.count <= 100 && stats.cache_bytes <= 100 * sizeof( struct djbhash_node ) );
+
+  // Finds mark items as used, so they outlive unmarked ones.
+  for ( i = 0; i < 10000; i++ )
+  {
+    djbhash_find( &hash, "key999" );
+    fill( &hash, i % 50 );
+  }
+  CHECK( djbhash_find( &hash, "key999" ) != NULL );
+  djbhash_destroy( &nested );
+  djbhash_destroy( &hash );
+}
+
 int main( int argc, char *argv[] )
 {
   // Hash table structure.
@@ -89,5 +890,32 @@ int main( int argc, char *argv[] )
   djbhash_destroy( &temp_hash );
   djbhash_destroy( &hash );
 
+  // Check each feature's behavior.
+  printf( "\nRunning tests...\n" );
+  test_table();
+  test_small();
+  test_node();
+  test_arena();
+  test_keys();
+  test_batch();
+  test_concurrent();
+  test_cursors();
+  test_json_writer();
+  test_json_loader();
+  test_snapshot();
+  test_ownership();
+  test_intern();
+  test_stats();
+  test_build();
+  test_parallel();
+  test_typed_arrays();
+  test_u64();
+  test_cache();
+  if ( failures > 0 )
+  {
+    printf( "%d checks failed.\n", failures );
+    return 1;
+  }
+  printf( "All tests passed.\n" );
   return 0;
 }
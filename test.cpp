@@ -0,0 +1,200 @@
+#include "djbhash.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Failed checks so far.
+static int failures = 0;
+
+// Report a failed check; tests keep going so one run shows every failure.
+#define CHECK( cond ) \
+  do \
+  { \
+    if ( !( cond ) ) \
+    { \
+      printf( "FAILED %s:%d: %s\n", __FILE__, __LINE__, #cond ); \
+      failures++; \
+    } \
+  } while ( 0 )
+
+// Counts live objects and copies, to check values are moved, not copied, and always destroyed.
+struct tracked {
+  static int live;
+  static int copies;
+  std::string s;
+
+  tracked( std::string value ) : s( std::move( value ) ) { live++; }
+  tracked( const tracked &other ) : s( other.s )
+  {
+    live++;
+    copies++;
+  }
+  tracked( tracked &&other ) noexcept : s( std::move( other.s ) ) { live++; }
+  tracked &operator=( const tracked & ) = default;
+  tracked &operator=( tracked && ) = default;
+  ~tracked() { live--; }
+};
+
+int tracked::live = 0;
+int tracked::copies = 0;
+
+// Dereferencing builds a pair, so the iterators only claim to be input iterators.
+static_assert( std::is_same_v<std::iterator_traits<djb::hash_map<int>::iterator>::iterator_category, std::input_iterator_tag> );
+
+// Lookups, updates, traversal order and erasing while iterating.
+static void test_basics( void )
+{
+  djb::hash_map<int> map;
+  std::string buffer = "xxk42yy";
+  long sum;
+  int count, previous;
+  bool ordered;
+
+  for ( int i = 0; i < 100000; i++ )
+    map["k" + std::to_string( i )] = i;
+  CHECK( map.size() == 100000 );
+  CHECK( map.find( std::string_view( buffer ).substr( 2, 3 ) )->second == 42 );
+  CHECK( map.at( "k99999" ) == 99999 && map.contains( "k0" ) && !map.contains( "nope" ) && map.count( "k5" ) == 1 );
+
+  sum = 0;
+  count = 0;
+  previous = -1;
+  ordered = true;
+  for ( auto [key, value] : map )
+  {
+    sum += value;
+    count++;
+    ordered = ordered && value > previous;
+    previous = value;
+  }
+  CHECK( count == 100000 && sum == 99999L * 100000 / 2 && ordered );
+
+  for ( auto it = map.begin(); it != map.end(); )
+  {
+    if ( it->second % 2 )
+      it = map.erase( it );
+    else
+      ++it;
+  }
+  CHECK( map.size() == 50000 && !map.contains( "k1" ) && map.contains( "k2" ) );
+
+  auto result = map.try_emplace( "k2", 7 );
+  CHECK( !result.second && result.first->second == 2 );
+  result = map.try_emplace( "new", 7 );
+  CHECK( result.second && result.first->second == 7 );
+  map.insert_or_assign( "k2", 5 );
+  CHECK( map["k2"] == 5 );
+
+  // ints are stored as DJBHASH_INT, so the C side understands them.
+  char *json = ( char * )djbhash_to_json( map.c_hash() );
+  CHECK( strstr( json, "\"new\":7" ) != nullptr );
+  free( json );
+
+  try
+  {
+    map.at( "missing" );
+    CHECK( false );
+  } catch ( const std::out_of_range & )
+  {
+  }
+
+  // Empty keys, and string_views with no data.
+  djb::hash_map<int> empty;
+  empty[std::string_view()] = 1;
+  CHECK( empty[""] == 1 );
+}
+
+// Erasing other items of a small map leaves iterators valid.
+static void test_small_iterators( void )
+{
+  djb::hash_map<int> map;
+  const char *keys[] = { "a", "b", "c", "d", "e", "f" };
+
+  for ( int i = 0; i < 6; i++ )
+    map[keys[i]] = i;
+  auto it = map.find( "d" );
+  map.erase( "b" );
+  CHECK( it->first == "d" );
+  ++it;
+  CHECK( it != map.end() && it->first == "e" );
+  map.erase( "a" );
+  map.erase( "c" );
+  it++;
+  CHECK( it != map.end() && it->first == "f" );
+  ++it;
+  CHECK( it == map.end() );
+
+  // erase( iterator ) with a stale position.
+  it = map.find( "e" );
+  map.erase( "d" );
+  it = map.erase( it );
+  CHECK( it != map.end() && it->first == "f" && map.size() == 1 );
+}
+
+// Copies are deep, moves hand the C hash over, and assignment goes through both.
+static void test_copy_move( void )
+{
+  djb::hash_map<int> map{ { "a", 1 }, { "b", 2 } };
+  djb::hash_map<int> copied = map;
+
+  copied["a"] = 9;
+  CHECK( map["a"] == 1 && copied["a"] == 9 );
+  djb::hash_map<int> moved = std::move( map );
+  CHECK( map.size() == 0 && moved.size() == 2 );
+  map = copied;
+  CHECK( map.size() == 2 && map["a"] == 9 );
+  map.clear();
+  CHECK( map.empty() );
+  swap( map, moved );
+  CHECK( map.size() == 2 && moved.empty() );
+
+  djb::hash_map<double> doubles{ { "pi", 3.14 }, { "e", 2.71 } };
+  doubles.erase( "pi" );
+  CHECK( doubles.size() == 1 && doubles.begin()->first == "e" && doubles.at( "e" ) == 2.71 );
+}
+
+// Values that don't fit in a node live on the heap, are moved in place and are destroyed with the map.
+static void test_heap_values( void )
+{
+  {
+    djb::hash_map<tracked> map;
+    tracked big( std::string( 100, 'x' ) );
+
+    map.try_emplace( "a", std::move( big ) );
+    CHECK( tracked::copies == 0 && map.at( "a" ).s.size() == 100 );
+    map.try_emplace( "b", "direct" );
+    map.insert_or_assign( "a", tracked( "again" ) );
+    CHECK( map.at( "a" ).s == "again" && tracked::copies == 0 );
+    djb::hash_map<tracked> copied = map;
+    CHECK( tracked::copies == 2 );
+    map.erase( "b" );
+
+    djb::hash_map<std::unique_ptr<int>> pointers;
+    pointers.try_emplace( "p", std::make_unique<int>( 5 ) );
+    CHECK( *pointers.at( "p" ) == 5 );
+
+    djb::hash_map<std::vector<double>> vectors;
+    for ( int i = 0; i < 1000; i++ )
+      vectors[std::to_string( i )].assign( 100, i );
+    vectors.erase( "3" );
+    CHECK( vectors.size() == 999 && vectors.at( "999" ).size() == 100 );
+  }
+  CHECK( tracked::live == 0 );
+}
+
+int main()
+{
+  test_basics();
+  test_small_iterators();
+  test_copy_move();
+  test_heap_values();
+  if ( failures > 0 )
+  {
+    printf( "%d checks failed.\n", failures );
+    return 1;
+  }
+  printf( "All C++ tests passed.\n" );
+  return 0;
+}